@@ -3,124 +3,264 @@
 #include "../../include/TimeNS.h"
 #include "../../include/Windowing.h"
 
+#include "LiveLOBServer.cxx"
+#include "LOBParallelUnzipScope.h"
+#include "LOBReplayCache.cxx"
+#include "SPSCQueue.h"
+
 #include <TGraph.h>
 #include <TFile.h>
 #include <TH1F.h>
 #include <TH2F.h>
+#include <TROOT.h>
+#include <TSystem.h>
 
 #include <list>
+#include <map>
+#include <set>
+#include <sstream>
 #include <string>
+#include <vector>
 #include <memory>
 #include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <numeric>
 
 // Maximum number of bins, limited by memory. If the required number of bins exceeds this number, automatic subsampling is applied
 constexpr int MAXBINS = 10000000;
 
-// A struct containing all the different histograms which are recorded
-struct LOBPlotConfig
+// Number of events which can be queued between the book stage and the fill stage in pipelined mode
+constexpr int PIPELINECAPACITY = 4096;
+
+struct LOBLevel
 {
-   void setup(const MetaData_t& metaData, int skip, const std::string& title, long numberOfBinsWindowHist, long numberOfMessages, TimeNS snapshotSize, int i, int yBinMargin)
+   int price;
+   int volume;
+};
+
+// Compact copy of the state of a book, containing everything needed to fill the plots. The levels are stored in
+// a buffer which is allocated once by reserve(), for the deepest book of the replay (see getPeriodStats).
+struct LOBBookSample
+{
+   void reserve(int levels)
    {
-      index = i;
+      depth = levels;
+      buffer.assign(2 * depth, LOBLevel{0, 0});
+   }
 
-      contractID = MetaDataGetID(metaData, contract);
-      if(contractID == -1) throw std::runtime_error("ID not found");
+   // Copy a book (a sample or one of the views below) into this sample
+   template <class Book>
+   void assign(const Book& book)
+   {
+      if(book.bidLevels > depth || book.askLevels > depth)
+      {
+         throw std::runtime_error("Book deeper than the " + std::to_string(depth) + " levels reserved for the samples");
+      }
 
-      const int lowTicks = low - yBinMargin;
-      const float lowHist = lowTicks * metaData.at(contractID).PriceIncrease; // - 0.5 * metaData.at(contractID).PriceIncrease;
-      const int highTicks = high + yBinMargin + 1;
-      const float highHist = highTicks * metaData.at(contractID).PriceIncrease; // - 0.5 * metaData.at(contractID).PriceIncrease;
+      bidLevels = book.bidLevels;
+      for(int i = 0; i < bidLevels; i++)
+      {
+         bid()[i] = LOBLevel{book.bidLevel(i).price, book.bidLevel(i).volume};
+      }
+      askLevels = book.askLevels;
+      for(int i = 0; i < askLevels; i++)
+      {
+         ask()[i] = LOBLevel{book.askLevel(i).price, book.askLevel(i).volume};
+      }
 
-      // Initiate histograms for windowed plot
-      histWindowLob = std::make_unique<TH2F>(("histWindowLob" + std::to_string(index)).c_str(), (title + ";;" + yAxisTitle).c_str(),
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second,
-         high - low + yBinMargin + yBinMargin + 1, lowHist, highHist);
-
-      histWindowTrade = std::make_unique<TH1F>(("histWindowTrade" + std::to_string(index)).c_str(), ";Time (seconds);Trade Volume",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-      histWindowCumulTrade = std::make_unique<TH1F>(("histWindowCumulTrade" + std::to_string(index)).c_str(), ";Time (seconds);#splitline{Cumul. Trade}{    Volume}",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-      histWindowCumulTradeBid = std::make_unique<TH1F>(("histWindowCumulTradeBid" + std::to_string(index)).c_str(), ";Time (seconds);#splitline{     Cumul. Sell}{Aggressor Volume}",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-      histWindowCumulTradeAsk = std::make_unique<TH1F>(("histWindowCumulTradeAsk" + std::to_string(index)).c_str(), ";Time (seconds);#splitline{     Cumul. Buy}{Aggressor Volume}",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-       histWindowPrice = std::make_unique<TH1F>(("histWindowPrice" + std::to_string(index)).c_str(), ";Time (seconds);Price (points)",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-
-      histWindowTime = std::make_unique<TH1F>(("histWindowTime" + std::to_string(index)).c_str(), ";Time (seconds);#splitline{Messages}{per snapshot}",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-
-      histWindowBidVolume = std::make_unique<TH1F>(("histWindowBidVolume" + std::to_string(index)).c_str(), "",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-      histWindowAskVolume = std::make_unique<TH1F>(("histWindowAskVolume" + std::to_string(index)).c_str(), "",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-
-      histWindowCancellationsBid = std::make_unique<TH1F>(("histWindowCancellationsBid" + std::to_string(index)).c_str(), ";;#splitline{Cumul. Bid Level 1}{   Cancellations}",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-      histWindowCancellationsAsk = std::make_unique<TH1F>(("histWindowCancellationsAsk" + std::to_string(index)).c_str(), ";;#splitline{Cumul. Ask Level 1}{   Cancellations}",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-
-      histWindowLevel1VolumeBid = std::make_unique<TH1F>(("histWindowLevel1VolumeBid" + std::to_string(index)).c_str(), ";;#splitline{Bid Level 1}{  Volume}",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-      histWindowLevel1VolumeAsk = std::make_unique<TH1F>(("histWindowLevel1VolumeAsk" + std::to_string(index)).c_str(), ";;#splitline{Ask Level 1}{  Volume}",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-
-      histWindowAPMBid = std::make_unique<TH1F>(("histWindowAPMBid" + std::to_string(index)).c_str(), ";;APM Bid",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-      histWindowAPMAsk = std::make_unique<TH1F>(("histWindowAPMAsk" + std::to_string(index)).c_str(), ";;APM Ask",
-         numberOfBinsWindowHist, 0, numberOfBinsWindowHist * snapshotSize / T_Second);
-
-      spreadWindowMarker = std::make_unique<TGraph>();
+      price = book.price;
+      bidVolume = book.bidVolume;
+      askVolume = book.askVolume;
+      apmBid = book.apmBid;
+      apmAsk = book.apmAsk;
+      midPoint = book.midPoint;
+   }
 
-      // Initiate historgrams for message Plot
-      histMessageLob = std::make_unique<TH2F>(("histMessageLob" + std::to_string(index)).c_str(), (title + ";;" + yAxisTitle).c_str(),
-         numberOfMessages / skip, 0, numberOfMessages,
-         high - low + yBinMargin + yBinMargin + 1, lowHist, highHist);
+   LOBLevel* bid() { return buffer.data(); }
+   LOBLevel* ask() { return buffer.data() + depth; }
+   const LOBLevel* bid() const { return buffer.data(); }
+   const LOBLevel* ask() const { return buffer.data() + depth; }
+
+   // The levels of a side, as read by the fill stage from samples and views alike
+   const LOBLevel& bidLevel(int i) const { return buffer[i]; }
+   const LOBLevel& askLevel(int i) const { return buffer[depth + i]; }
+
+   int depth = 0;  // capacity of each side
+   int bidLevels = 0;
+   int askLevels = 0;
+   std::vector<LOBLevel> buffer;
+
+   double price = 0;
+   double bidVolume = 0;
+   double askVolume = 0;
+   double apmBid = 0;
+   double apmAsk = 0;
+   double midPoint = 0;
+};
 
-      histMessageTrade = std::make_unique<TH1F>(("histMessageTrade" + std::to_string(index)).c_str(), ";;Trade Volume",
-         numberOfMessages / skip, 0, numberOfMessages);
-      histMessageCumulTrade = std::make_unique<TH1F>(("histMessageCumulTrade" + std::to_string(index)).c_str(), ";;#splitline{Cumul. Trade}{    Volume}",
-         numberOfMessages / skip, 0, numberOfMessages);
-      histMessageCumulTradeBid = std::make_unique<TH1F>(("histMessageCumulTradeBid" + std::to_string(index)).c_str(), ";;#splitline{     Cumul. Sell}{Aggressor Volume}",
-         numberOfMessages / skip, 0, numberOfMessages);
-      histMessageCumulTradeAsk = std::make_unique<TH1F>(("histMessageCumulTradeAsk" + std::to_string(index)).c_str(), ";;#splitline{     Cumul. Buy}{Aggressor Volume}",
-         numberOfMessages / skip, 0, numberOfMessages);
-      histMessagePrice = std::make_unique<TH1F>(("histMessagePrice" + std::to_string(index)).c_str(), ";;Price (points)",
-         numberOfMessages / skip, 0, numberOfMessages);
+// View of the book of a Security with the same members as a sample, so the fill stage can read the book directly
+// instead of a copy when it runs in the same thread as the book stage
+struct LOBSecurityBook
+{
+   // low, high: range of the config for the volumes with cutMissing, in ticks
+   LOBSecurityBook(const Security& security, bool cutMissing, int low, int high, double priceIncrease, double dollarValue)
+      : bidBook(security.getBook(BookSide::BidConsolidated)), askBook(security.getBook(BookSide::AskConsolidated))
+   {
+      bidLevels = bidBook->size();
+      askLevels = askBook->size();
 
-      histMessageTime = std::make_unique<TH1F>(("histMessageTime" + std::to_string(index)).c_str(), ";Message number;Messages per snapshot",
-         numberOfMessages / skip, 0, numberOfMessages);
+      price = security.getPrice() * priceIncrease;
 
-      histMessageBidVolume = std::make_unique<TH1F>(("histMessageBidVolume" + std::to_string(index)).c_str(), "",
-         numberOfMessages / skip, 0, numberOfMessages);
-      histMessageAskVolume = std::make_unique<TH1F>(("histMessageAskVolume" + std::to_string(index)).c_str(), "",
-         numberOfMessages / skip, 0, numberOfMessages);
+      if(!cutMissing)
+      {
+         bidVolume = security.getVolume(BookSide::BidConsolidated);
+         askVolume = security.getVolume(BookSide::AskConsolidated);
+      }
+      else
+      {
+         bidVolume = security.getVolume(BookSide::BidConsolidated, low);
+         askVolume = security.getVolume(BookSide::AskConsolidated, high);
+      }
 
-      histMessageCancellationsBid = std::make_unique<TH1F>(("histMessageCancellationsBid" + std::to_string(index)).c_str(), ";;#splitline{Cumul. Bid Level 1}{   Cancellations}",
-         numberOfMessages / skip, 0, numberOfMessages);
-      histMessageCancellationsAsk = std::make_unique<TH1F>(("histMessageCancellationsAsk" + std::to_string(index)).c_str(), ";;#splitline{Cumul. Ask Level 1}{   Cancellations}",
-         numberOfMessages / skip, 0, numberOfMessages);
+      bool saturated = false;
+      apmBid = security.getAPM(BookSide::BidConsolidated, dollarValue / priceIncrease, saturated);
+      apmAsk = security.getAPM(BookSide::AskConsolidated, dollarValue / priceIncrease, saturated);
 
-      histMessageLevel1VolumeBid = std::make_unique<TH1F>(("histMessageLevel1VolumeBid" + std::to_string(index)).c_str(), ";;#splitline{Bid Level 1}{  Volume}",
-         numberOfMessages / skip, 0, numberOfMessages);
-      histMessageLevel1VolumeAsk = std::make_unique<TH1F>(("histMessageLevel1VolumeAsk" + std::to_string(index)).c_str(), ";;#splitline{Ask Level 1}{  Volume}",
-         numberOfMessages / skip, 0, numberOfMessages);
+      midPoint = (security.getMidPoint(Book::Consolidated) + 0.5) * priceIncrease;
+   }
 
-      histMessageAPMBid = std::make_unique<TH1F>(("histMessageAPMBid" + std::to_string(index)).c_str(), ";;APM Bid",
-         numberOfMessages / skip, 0, numberOfMessages);
-      histMessageAPMAsk = std::make_unique<TH1F>(("histMessageAPMAsk" + std::to_string(index)).c_str(), ";;APM Ask",
-         numberOfMessages / skip, 0, numberOfMessages);
+   const auto& bidLevel(int i) const { return bidBook->at(i); }
+   const auto& askLevel(int i) const { return askBook->at(i); }
+
+   decltype(std::declval<const Security&>().getBook(BookSide::BidConsolidated)) bidBook;
+   decltype(std::declval<const Security&>().getBook(BookSide::AskConsolidated)) askBook;
 
-      spreadMessageMarker = std::make_unique<TGraph>();
+   int bidLevels = 0;
+   int askLevels = 0;
+
+   double price = 0;
+   double bidVolume = 0;
+   double askVolume = 0;
+   double apmBid = 0;
+   double apmAsk = 0;
+   double midPoint = 0;
+};
+
+// The spread marker, a step function of the mid point. Only the samples where the mid point changes are stored,
+// in buffers reserved for the maximum number of samples, and converted into a TGraph once when saving.
+struct LOBSpreadSeries
+{
+   void reserve(long samples)
+   {
+      x.reserve(samples);
+      y.reserve(samples);
    }
 
-   void save(TFile& file)
+   void add(double sampleX, double sampleY)
    {
-      histWindowLob->SetMaximum(maxVolume);
-      histMessageLob->SetMaximum(maxVolume);
+      if(x.empty() || sampleY != y.back())
+      {
+         x.push_back(sampleX);
+         y.push_back(sampleY);
+      }
+      lastX = sampleX;
+   }
 
-      TNamed contractName(("contractName" + std::to_string(index)).c_str(), contract);
-      file.WriteObject(&contractName, contractName.GetName());
+   // The step function: a horizontal line up to each change, a vertical line at each change, up to the last sample
+   std::unique_ptr<TGraph> toGraph(const std::string& name) const
+   {
+      std::vector<double> graphX;
+      std::vector<double> graphY;
+      graphX.reserve(2 * x.size() + 1);
+      graphY.reserve(2 * x.size() + 1);
+
+      for(std::size_t i = 0; i < x.size(); i++)
+      {
+         if(i > 0)
+         {
+            graphX.push_back(x[i]);
+            graphY.push_back(y[i - 1]);
+         }
+         graphX.push_back(x[i]);
+         graphY.push_back(y[i]);
+      }
+      if(!x.empty() && lastX > x.back())
+      {
+         graphX.push_back(lastX);
+         graphY.push_back(y.back());
+      }
+
+      auto graph = graphX.empty() ? std::make_unique<TGraph>() : std::make_unique<TGraph>(graphX.size(), graphX.data(), graphY.data());
+      graph->SetName(name.c_str());
+      return graph;
+   }
+
+   std::vector<double> x;
+   std::vector<double> y;
+   double lastX = 0;
+};
+
+// The histograms of the window plot (one bin per snapshot) of a config for one snapshot size
+struct LOBWindowSeries
+{
+   void setup(const std::string& title, const std::string& yAxisTitle, int index, const std::string& seriesSuffix, TimeNS size, long numberOfBins, long numberOfTrades, int yBins, float lowHist, float highHist)
+   {
+      name = std::to_string(index) + seriesSuffix;
+      suffix = seriesSuffix;
+      snapshotSize = size;
+
+      // Initiate histograms for windowed plot
+      histWindowLob = std::make_unique<TH2F>(("histWindowLob" + std::to_string(index) + suffix).c_str(), (title + ";;" + yAxisTitle).c_str(),
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second,
+         yBins, lowHist, highHist);
+
+      histWindowTrade = std::make_unique<TH1F>(("histWindowTrade" + std::to_string(index) + suffix).c_str(), ";Time (seconds);Trade Volume",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+      histWindowCumulTrade = std::make_unique<TH1F>(("histWindowCumulTrade" + std::to_string(index) + suffix).c_str(), ";Time (seconds);#splitline{Cumul. Trade}{    Volume}",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+      histWindowCumulTradeBid = std::make_unique<TH1F>(("histWindowCumulTradeBid" + std::to_string(index) + suffix).c_str(), ";Time (seconds);#splitline{     Cumul. Sell}{Aggressor Volume}",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+      histWindowCumulTradeAsk = std::make_unique<TH1F>(("histWindowCumulTradeAsk" + std::to_string(index) + suffix).c_str(), ";Time (seconds);#splitline{     Cumul. Buy}{Aggressor Volume}",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+       histWindowPrice = std::make_unique<TH1F>(("histWindowPrice" + std::to_string(index) + suffix).c_str(), ";Time (seconds);Price (points)",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+
+      histWindowTime = std::make_unique<TH1F>(("histWindowTime" + std::to_string(index) + suffix).c_str(), ";Time (seconds);#splitline{Messages}{per snapshot}",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+
+      histWindowBidVolume = std::make_unique<TH1F>(("histWindowBidVolume" + std::to_string(index) + suffix).c_str(), "",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+      histWindowAskVolume = std::make_unique<TH1F>(("histWindowAskVolume" + std::to_string(index) + suffix).c_str(), "",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+
+      histWindowCancellationsBid = std::make_unique<TH1F>(("histWindowCancellationsBid" + std::to_string(index) + suffix).c_str(), ";;#splitline{Cumul. Bid Level 1}{   Cancellations}",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+      histWindowCancellationsAsk = std::make_unique<TH1F>(("histWindowCancellationsAsk" + std::to_string(index) + suffix).c_str(), ";;#splitline{Cumul. Ask Level 1}{   Cancellations}",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+
+      histWindowLevel1VolumeBid = std::make_unique<TH1F>(("histWindowLevel1VolumeBid" + std::to_string(index) + suffix).c_str(), ";;#splitline{Bid Level 1}{  Volume}",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+      histWindowLevel1VolumeAsk = std::make_unique<TH1F>(("histWindowLevel1VolumeAsk" + std::to_string(index) + suffix).c_str(), ";;#splitline{Ask Level 1}{  Volume}",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+
+      histWindowAPMBid = std::make_unique<TH1F>(("histWindowAPMBid" + std::to_string(index) + suffix).c_str(), ";;APM Bid",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+      histWindowAPMAsk = std::make_unique<TH1F>(("histWindowAPMAsk" + std::to_string(index) + suffix).c_str(), ";;APM Ask",
+         numberOfBins, 0, numberOfBins * snapshotSize / T_Second);
+
+      // Snapshots are taken from beginTime up to and including endTime
+      spreadWindowMarker.reserve(numberOfBins + 1);
+      windowTrades.reserve(numberOfTrades);
+   }
+
+   void save(TFile& file, int maxVolume)
+   {
+      histWindowLob->SetMaximum(maxVolume);
 
       file.WriteObject(histWindowLob.get(), histWindowLob->GetName());
 
@@ -144,36 +284,10 @@ struct LOBPlotConfig
       file.WriteObject(histWindowAPMBid.get(), histWindowAPMBid->GetName());
       file.WriteObject(histWindowAPMAsk.get(), histWindowAPMAsk->GetName());
 
-      file.WriteObject(spreadWindowMarker.get(), ("spreadWindowMarker" + std::to_string(index)).c_str());
-
-      file.WriteObject(&windowTrades, "windowTrades");
-
-
-      file.WriteObject(histMessageLob.get(), histMessageLob->GetName());
-      
-      file.WriteObject(histMessageTrade.get(), histMessageTrade->GetName());
-      file.WriteObject(histMessageCumulTrade.get(), histMessageCumulTrade->GetName());
-      file.WriteObject(histMessageCumulTradeBid.get(), histMessageCumulTradeBid->GetName());
-      file.WriteObject(histMessageCumulTradeAsk.get(), histMessageCumulTradeAsk->GetName());
-      file.WriteObject(histMessagePrice.get(), histMessagePrice->GetName());
-
-      file.WriteObject(histMessageTime.get(), histMessageTime->GetName());
-
-      file.WriteObject(histMessageBidVolume.get(), histMessageBidVolume->GetName());
-      file.WriteObject(histMessageAskVolume.get(), histMessageAskVolume->GetName());
-
-      file.WriteObject(histMessageCancellationsBid.get(), histMessageCancellationsBid->GetName());
-      file.WriteObject(histMessageCancellationsAsk.get(), histMessageCancellationsAsk->GetName());
-
-      file.WriteObject(histMessageLevel1VolumeBid.get(), histMessageLevel1VolumeBid->GetName());
-      file.WriteObject(histMessageLevel1VolumeAsk.get(), histMessageLevel1VolumeAsk->GetName());
-
-      file.WriteObject(histMessageAPMBid.get(), histMessageAPMBid->GetName());
-      file.WriteObject(histMessageAPMAsk.get(), histMessageAPMAsk->GetName());
+      auto spreadGraph = spreadWindowMarker.toGraph("spreadWindowMarker" + name);
+      file.WriteObject(spreadGraph.get(), spreadGraph->GetName());
 
-      file.WriteObject(spreadMessageMarker.get(), ("spreadMessageMarker" + std::to_string(index)).c_str());
-
-      file.WriteObject(&messageTrades, "messageTrades");
+      file.WriteObject(&windowTrades, ("windowTrades" + suffix).c_str());
 
       histWindowLob.reset();
 
@@ -181,98 +295,31 @@ struct LOBPlotConfig
       histWindowCumulTrade.reset();
       histWindowCumulTradeBid.reset();
       histWindowCumulTradeAsk.reset();
+      histWindowPrice.reset();
 
       histWindowTime.reset();
 
       histWindowBidVolume.reset();
       histWindowAskVolume.reset();
 
-      spreadWindowMarker.reset();
-
-
-      histMessageLob.reset();
-
-      histMessageTrade.reset();
-      histMessageCumulTrade.reset();
-      histMessageCumulTradeBid.reset();
-      histMessageCumulTradeAsk.reset();
-
-      histMessageTime.reset();
-
-      histMessageBidVolume.reset();
-      histMessageAskVolume.reset();
-
-      spreadMessageMarker.reset();
-   }
+      histWindowCancellationsBid.reset();
+      histWindowCancellationsAsk.reset();
 
-   void addSpreadMarkerWindow(double x, double y)
-   {
-      if(spreadWindowFirst)
-      {
-         spreadWindowFirst = false;
-         spreadWindowMarker->SetPoint(spreadWindowMarkerNumber, x, y);
-         spreadWindowMarkerNumber++;
-         spreadWindowLast = y;
-      }
-      else
-      {
-         spreadWindowMarker->SetPoint(spreadWindowMarkerNumber, x, spreadWindowLast);
-         spreadWindowMarkerNumber++;
-         spreadWindowMarker->SetPoint(spreadWindowMarkerNumber, x, y);
-         spreadWindowMarkerNumber++;
-         spreadWindowLast = y;
-      }
-   }
+      histWindowLevel1VolumeBid.reset();
+      histWindowLevel1VolumeAsk.reset();
 
-   void addSpreadMarkerMessage(double x, double y)
-   {
-      if(spreadMessageFirst)
-      {
-         spreadMessageFirst = false;
-         spreadMessageMarker->SetPoint(spreadMessageMarkerNumber, x, y);
-         spreadMessageMarkerNumber++;
-         spreadMessageLast = y;
-      }
-      else
-      {
-         spreadMessageMarker->SetPoint(spreadMessageMarkerNumber, x, spreadMessageLast);
-         spreadMessageMarkerNumber++;
-         spreadMessageMarker->SetPoint(spreadMessageMarkerNumber, x, y);
-         spreadMessageMarkerNumber++;
-         spreadMessageLast = y;
-      }
+      histWindowAPMBid.reset();
+      histWindowAPMAsk.reset();
    }
 
-   int index = 1;
-   int low = 99999;
-   int high = 0;
-   int maxVolume= 0 ;
-   long messages = 0;
-   int contractID = -1;
-   double dollarValue = 0;
-
-   std::string fileName;
-   std::string contract;
-   std::string yAxisTitle;
+   std::string name;
+   std::string suffix;
+   TimeNS snapshotSize = 0;
 
+   long long currentWindowNumber = 0;
+   long snapshotStartMessage = 0;
    long tradeVolumeSinceLastSnapshot = 0;
-   long totalTradeVolume = 0;
-   long tradeVolumeSinceLastMessage = 0;
-   long bidTradeVolume = 0;
-   long askTradeVolume = 0;
-   long unexplainedTradeVolume = 0;
    long numberOfMessagesSinceLastSnapshot = 0;
-   long numberOfMessagesSinceStart = 0;
-   long bidCancellations = 0;
-   long askCancellations = 0;
-
-   bool spreadWindowFirst = true;
-   double spreadWindowLast = 0.0;
-   long spreadWindowMarkerNumber = 0;
-
-   bool spreadMessageFirst = true;
-   double spreadMessageLast = 0.0;
-   long spreadMessageMarkerNumber = 0;
 
    std::unique_ptr<TH2F> histWindowLob;
 
@@ -296,10 +343,120 @@ struct LOBPlotConfig
    std::unique_ptr<TH1F> histWindowAPMBid;
    std::unique_ptr<TH1F> histWindowAPMAsk;
 
-   std::unique_ptr<TGraph> spreadWindowMarker;
+   LOBSpreadSeries spreadWindowMarker;
 
    std::vector<double> windowTrades;
+};
+
+// The histograms of the message plot (one bin per skip messages) of a config for one skip interval
+struct LOBMessageSeries
+{
+   void setup(const std::string& title, const std::string& yAxisTitle, int index, const std::string& seriesSuffix, int messageSkip, long numberOfMessages, long numberOfTrades, int yBins, float lowHist, float highHist)
+   {
+      name = std::to_string(index) + seriesSuffix;
+      suffix = seriesSuffix;
+      skip = messageSkip;
+
+      // Initiate historgrams for message Plot
+      histMessageLob = std::make_unique<TH2F>(("histMessageLob" + std::to_string(index) + suffix).c_str(), (title + ";;" + yAxisTitle).c_str(),
+         numberOfMessages / skip, 0, numberOfMessages,
+         yBins, lowHist, highHist);
+
+      histMessageTrade = std::make_unique<TH1F>(("histMessageTrade" + std::to_string(index) + suffix).c_str(), ";;Trade Volume",
+         numberOfMessages / skip, 0, numberOfMessages);
+      histMessageCumulTrade = std::make_unique<TH1F>(("histMessageCumulTrade" + std::to_string(index) + suffix).c_str(), ";;#splitline{Cumul. Trade}{    Volume}",
+         numberOfMessages / skip, 0, numberOfMessages);
+      histMessageCumulTradeBid = std::make_unique<TH1F>(("histMessageCumulTradeBid" + std::to_string(index) + suffix).c_str(), ";;#splitline{     Cumul. Sell}{Aggressor Volume}",
+         numberOfMessages / skip, 0, numberOfMessages);
+      histMessageCumulTradeAsk = std::make_unique<TH1F>(("histMessageCumulTradeAsk" + std::to_string(index) + suffix).c_str(), ";;#splitline{     Cumul. Buy}{Aggressor Volume}",
+         numberOfMessages / skip, 0, numberOfMessages);
+      histMessagePrice = std::make_unique<TH1F>(("histMessagePrice" + std::to_string(index) + suffix).c_str(), ";;Price (points)",
+         numberOfMessages / skip, 0, numberOfMessages);
+
+      histMessageTime = std::make_unique<TH1F>(("histMessageTime" + std::to_string(index) + suffix).c_str(), ";Message number;Messages per snapshot",
+         numberOfMessages / skip, 0, numberOfMessages);
+
+      histMessageBidVolume = std::make_unique<TH1F>(("histMessageBidVolume" + std::to_string(index) + suffix).c_str(), "",
+         numberOfMessages / skip, 0, numberOfMessages);
+      histMessageAskVolume = std::make_unique<TH1F>(("histMessageAskVolume" + std::to_string(index) + suffix).c_str(), "",
+         numberOfMessages / skip, 0, numberOfMessages);
+
+      histMessageCancellationsBid = std::make_unique<TH1F>(("histMessageCancellationsBid" + std::to_string(index) + suffix).c_str(), ";;#splitline{Cumul. Bid Level 1}{   Cancellations}",
+         numberOfMessages / skip, 0, numberOfMessages);
+      histMessageCancellationsAsk = std::make_unique<TH1F>(("histMessageCancellationsAsk" + std::to_string(index) + suffix).c_str(), ";;#splitline{Cumul. Ask Level 1}{   Cancellations}",
+         numberOfMessages / skip, 0, numberOfMessages);
+
+      histMessageLevel1VolumeBid = std::make_unique<TH1F>(("histMessageLevel1VolumeBid" + std::to_string(index) + suffix).c_str(), ";;#splitline{Bid Level 1}{  Volume}",
+         numberOfMessages / skip, 0, numberOfMessages);
+      histMessageLevel1VolumeAsk = std::make_unique<TH1F>(("histMessageLevel1VolumeAsk" + std::to_string(index) + suffix).c_str(), ";;#splitline{Ask Level 1}{  Volume}",
+         numberOfMessages / skip, 0, numberOfMessages);
+
+      histMessageAPMBid = std::make_unique<TH1F>(("histMessageAPMBid" + std::to_string(index) + suffix).c_str(), ";;APM Bid",
+         numberOfMessages / skip, 0, numberOfMessages);
+      histMessageAPMAsk = std::make_unique<TH1F>(("histMessageAPMAsk" + std::to_string(index) + suffix).c_str(), ";;APM Ask",
+         numberOfMessages / skip, 0, numberOfMessages);
+
+      spreadMessageMarker.reserve(numberOfMessages / skip + 1);
+      messageTrades.reserve(numberOfTrades);
+   }
+
+   void save(TFile& file, int maxVolume)
+   {
+      histMessageLob->SetMaximum(maxVolume);
+
+      file.WriteObject(histMessageLob.get(), histMessageLob->GetName());
+      
+      file.WriteObject(histMessageTrade.get(), histMessageTrade->GetName());
+      file.WriteObject(histMessageCumulTrade.get(), histMessageCumulTrade->GetName());
+      file.WriteObject(histMessageCumulTradeBid.get(), histMessageCumulTradeBid->GetName());
+      file.WriteObject(histMessageCumulTradeAsk.get(), histMessageCumulTradeAsk->GetName());
+      file.WriteObject(histMessagePrice.get(), histMessagePrice->GetName());
+
+      file.WriteObject(histMessageTime.get(), histMessageTime->GetName());
+
+      file.WriteObject(histMessageBidVolume.get(), histMessageBidVolume->GetName());
+      file.WriteObject(histMessageAskVolume.get(), histMessageAskVolume->GetName());
+
+      file.WriteObject(histMessageCancellationsBid.get(), histMessageCancellationsBid->GetName());
+      file.WriteObject(histMessageCancellationsAsk.get(), histMessageCancellationsAsk->GetName());
+
+      file.WriteObject(histMessageLevel1VolumeBid.get(), histMessageLevel1VolumeBid->GetName());
+      file.WriteObject(histMessageLevel1VolumeAsk.get(), histMessageLevel1VolumeAsk->GetName());
+
+      file.WriteObject(histMessageAPMBid.get(), histMessageAPMBid->GetName());
+      file.WriteObject(histMessageAPMAsk.get(), histMessageAPMAsk->GetName());
+
+      auto spreadGraph = spreadMessageMarker.toGraph("spreadMessageMarker" + name);
+      file.WriteObject(spreadGraph.get(), spreadGraph->GetName());
+
+      file.WriteObject(&messageTrades, ("messageTrades" + suffix).c_str());
+
+      histMessageLob.reset();
+
+      histMessageTrade.reset();
+      histMessageCumulTrade.reset();
+      histMessageCumulTradeBid.reset();
+      histMessageCumulTradeAsk.reset();
+      histMessagePrice.reset();
+
+      histMessageTime.reset();
+
+      histMessageBidVolume.reset();
+      histMessageAskVolume.reset();
+
+      histMessageCancellationsBid.reset();
+      histMessageCancellationsAsk.reset();
+
+      histMessageLevel1VolumeBid.reset();
+      histMessageLevel1VolumeAsk.reset();
 
+      histMessageAPMBid.reset();
+      histMessageAPMAsk.reset();
+   }
+
+   std::string name;
+   std::string suffix;
+   int skip = 1;
 
    std::unique_ptr<TH2F> histMessageLob;
 
@@ -323,45 +480,1269 @@ struct LOBPlotConfig
    std::unique_ptr<TH1F> histMessageAPMBid;
    std::unique_ptr<TH1F> histMessageAPMAsk;
 
-   std::unique_ptr<TGraph> spreadMessageMarker;
+   LOBSpreadSeries spreadMessageMarker;
 
    std::vector<double> messageTrades;
 };
 
-// Function to calculate some of the required parameters, runs before the main loop. Should not be called by user.
-void getPeriodStats(std::vector<LOBPlotConfig>& configs, TimeNS beginTime, TimeNS endTime, const std::string &rootPath, bool cutMissing)
+// Name suffixes of the histograms of the additional snapshot sizes and skip intervals, in the largest unit
+// dividing the snapshot size, e.g. _10s, _100ms or _500ns
+std::string windowSeriesSuffix(TimeNS snapshotSize)
 {
-   std::set<std::string> fileNames;
-   std::set<int> ids;
+   if(snapshotSize % T_Second == 0) return "_" + std::to_string(snapshotSize / T_Second) + "s";
+   if(snapshotSize % T_Milis == 0) return "_" + std::to_string(snapshotSize / T_Milis) + "ms";
+   return "_" + std::to_string(snapshotSize) + "ns";
+}
 
-   for(auto& config : configs)
+std::string messageSeriesSuffix(int skip)
+{
+   return "_skip" + std::to_string(skip);
+}
+
+// A struct containing all the different histograms which are recorded
+struct LOBPlotConfig
+{
+   // The first snapshot size and skip interval are the main ones, their histograms are named without suffix
+   void setup(const MetaData_t& metaData, const std::vector<int>& skips, const std::string& title, TimeNS windowLength, long numberOfMessages, const std::vector<TimeNS>& snapshotSizes, int i, int yBinMargin)
    {
-      fileNames.insert(config.fileName);
-   }
+      contractID = MetaDataGetID(metaData, contract);
+      if(contractID == -1) throw std::runtime_error("ID not found");
+      priceIncrease = metaData.at(contractID).PriceIncrease;
 
-   std::vector<std::unique_ptr<TFile>> files;
-   Windower<> windower;
-   MetaData_t metaData;
+      setupSeries(skips, title, windowLength, numberOfMessages, snapshotSizes, i, yBinMargin);
+   }
 
-   for(auto& fileName : fileNames)
+   // Create the histograms of all series, using low, high, trades and priceIncrease
+   void setupSeries(const std::vector<int>& skips, const std::string& title, TimeNS windowLength, long numberOfMessages, const std::vector<TimeNS>& snapshotSizes, int i, int yBinMargin)
    {
-      std::string filePath = rootPath + "/" + fileName;
-      files.push_back(std::make_unique<TFile>(filePath.c_str()));
-      if (!files.back()) throw std::invalid_argument("Could not open " + filePath);
+      index = i;
 
-      ReadMetaData(*files.back(), metaData);
-      windower.addTree(files.back().get(), "Messages");
+      const int lowTicks = low - yBinMargin;
+      const float lowHist = lowTicks * priceIncrease; // - 0.5 * priceIncrease;
+      const int highTicks = high + yBinMargin + 1;
+      const float highHist = highTicks * priceIncrease; // - 0.5 * priceIncrease;
+      const int yBins = high - low + yBinMargin + yBinMargin + 1;
+
+      windows.resize(snapshotSizes.size());
+      for(int w = 0; w < snapshotSizes.size(); w++)
+      {
+         windows[w].setup(title, yAxisTitle, index, w == 0 ? "" : windowSeriesSuffix(snapshotSizes[w]),
+            snapshotSizes[w], windowLength / snapshotSizes[w], trades, yBins, lowHist, highHist);
+      }
+
+      messageSeries.resize(skips.size());
+      for(int m = 0; m < skips.size(); m++)
+      {
+         messageSeries[m].setup(title, yAxisTitle, index, m == 0 ? "" : messageSeriesSuffix(skips[m]),
+            skips[m], numberOfMessages, trades, yBins, lowHist, highHist);
+      }
+   }
+
+   void save(TFile& file)
+   {
+      TNamed contractName(("contractName" + std::to_string(index)).c_str(), contract);
+      file.WriteObject(&contractName, contractName.GetName());
+
+      for(auto& series : windows)
+      {
+         series.save(file, maxVolume);
+      }
+
+      for(auto& series : messageSeries)
+      {
+         series.save(file, maxVolume);
+      }
+   }
+
+   // View of the book of this contract, called by the book stage
+   LOBSecurityBook book(const Security& security, bool cutMissing) const
+   {
+      return LOBSecurityBook(security, cutMissing, low, high, priceIncrease, dollarValue);
+   }
+
+   // Copy the state of the book of this contract into a sample
+   void sampleBook(const Security& security, bool cutMissing, LOBBookSample& sample) const
+   {
+      sample.assign(book(security, cutMissing));
+   }
+
+   template <class Book>
+   void fillLevels(TH2F& hist, long bin, const Book& sample, int yBinMargin)
+   {
+      for(int i = 0; i < sample.bidLevels; i++)
+      {
+         if(sample.bidLevel(i).price > 0)
+         {
+            hist.SetBinContent(bin, sample.bidLevel(i).price - low + yBinMargin + 1, sample.bidLevel(i).volume);
+         }
+      }
+      for(int i = 0; i < sample.askLevels; i++)
+      {
+         if(sample.askLevel(i).price > 0)
+         {
+            hist.SetBinContent(bin, sample.askLevel(i).price - low + yBinMargin + 1, sample.askLevel(i).volume);
+         }
+      }
+   }
+
+   // Fill a snapshot into the window plot, called by the fill stage with a sample or a view of the book
+   template <class Book>
+   void fillWindow(LOBWindowSeries& series, const Book& sample, int yBinMargin)
+   {
+      const long bin = series.currentWindowNumber + 1;
+      const double x = static_cast<double>(series.currentWindowNumber * series.snapshotSize) / T_Second;
+
+      fillLevels(*series.histWindowLob, bin, sample, yBinMargin);
+
+      series.histWindowTrade->SetBinContent(bin, series.tradeVolumeSinceLastSnapshot);
+      series.histWindowCumulTrade->SetBinContent(bin, totalTradeVolume);
+      series.histWindowCumulTradeBid->SetBinContent(bin, bidTradeVolume);
+      series.histWindowCumulTradeAsk->SetBinContent(bin, askTradeVolume);
+      series.histWindowPrice->SetBinContent(bin, sample.price);
+
+      series.histWindowBidVolume->SetBinContent(bin, sample.bidVolume);
+      series.histWindowAskVolume->SetBinContent(bin, sample.askVolume);
+
+      series.histWindowCancellationsBid->SetBinContent(bin, bidCancellations);
+      series.histWindowCancellationsAsk->SetBinContent(bin, askCancellations);
+
+      if(sample.bidLevels >= 1)
+      {
+         series.histWindowLevel1VolumeBid->SetBinContent(bin, sample.bidLevel(0).volume);
+      }
+      if(sample.askLevels >= 1)
+      {
+         series.histWindowLevel1VolumeAsk->SetBinContent(bin, sample.askLevel(0).volume);
+      }
+
+      series.histWindowAPMBid->SetBinContent(bin, sample.apmBid);
+      series.histWindowAPMAsk->SetBinContent(bin, sample.apmAsk);
+
+      series.spreadWindowMarker.add(x, sample.midPoint);
+   }
+
+   // Fill a sampled message into the message plot, called by the fill stage with a sample or a view of the book
+   template <class Book>
+   void fillMessage(LOBMessageSeries& series, long long messageNumber, const Book& sample, int yBinMargin)
+   {
+      const long bin = 1 + messageNumber / series.skip;
+
+      fillLevels(*series.histMessageLob, bin, sample, yBinMargin);
+
+      tradeVolumeSinceLastMessage = 0;
+      series.histMessageCumulTrade->SetBinContent(bin, totalTradeVolume);
+      series.histMessageCumulTradeBid->SetBinContent(bin, bidTradeVolume);
+      series.histMessageCumulTradeAsk->SetBinContent(bin, askTradeVolume);
+      series.histMessagePrice->SetBinContent(bin, sample.price);
+
+      series.histMessageBidVolume->SetBinContent(bin, sample.bidVolume);
+      series.histMessageAskVolume->SetBinContent(bin, sample.askVolume);
+
+      series.histMessageCancellationsBid->SetBinContent(bin, bidCancellations);
+      series.histMessageCancellationsAsk->SetBinContent(bin, askCancellations);
+
+      if(sample.bidLevels >= 1)
+      {
+         series.histMessageLevel1VolumeBid->SetBinContent(bin, sample.bidLevel(0).volume);
+      }
+      if(sample.askLevels >= 1)
+      {
+         series.histMessageLevel1VolumeAsk->SetBinContent(bin, sample.askLevel(0).volume);
+      }
+
+      series.histMessageAPMBid->SetBinContent(bin, sample.apmBid);
+      series.histMessageAPMAsk->SetBinContent(bin, sample.apmAsk);
+
+      series.spreadMessageMarker.add(messageNumber, sample.midPoint);
    }
 
+   int index = 1;
+   int low = 99999;
+   int high = 0;
+   int maxVolume= 0 ;
+   long messages = 0;
+   long trades = 0;
+   int maxDepth = 0; // levels of the deepest book side up to endTime
+   int contractID = -1;
+   double priceIncrease = 0;
+   double dollarValue = 0;
+
+   std::string fileName;
+   std::string contract;
+   std::string yAxisTitle;
+
+   long totalTradeVolume = 0;
+   long tradeVolumeSinceLastMessage = 0;
+   long bidTradeVolume = 0;
+   long askTradeVolume = 0;
+   long unexplainedTradeVolume = 0;
+   long numberOfMessagesSinceStart = 0;
+   long bidCancellations = 0;
+   long askCancellations = 0;
+
+   // One series per snapshot size and per skip interval
+   std::vector<LOBWindowSeries> windows;
+   std::vector<LOBMessageSeries> messageSeries;
+};
+
+// Optional parameters of GenerateLiveLOBPlot
+struct LOBGeneratorOptions
+{
+   // Engine of the embedded HTTP server publishing the plots while they are filled (e.g. "http:8080"), empty to disable
+   std::string httpServer;
+   // Replay speed relative to the message time stamps while serving, e.g. 1 for real time, 0 for as fast as possible
+   double replaySpeed = 0;
+   // Seconds the server keeps running after the replay, until the clients fetched the last columns, 0 to stop immediately
+   double httpLinger = 30;
+   // Directory containing LiveLOB.htm, empty for the directory of LiveLOBServer.cxx at compile time
+   std::string httpViewDirectory;
+   // Fill the histograms in a separate thread, and decompress the input in parallel. The rows are still decoded
+   // and applied to the books in one thread (the windower), so this is a two-stage pipeline.
+   bool pipelined = false;
+   // Number of threads decompressing the input in pipelined mode, 0 for all cores
+   unsigned int pipelineThreads = 0;
+   // Directory of the replay cache, empty to replay the input files directly. The first run over a set of input files
+   // and contracts converts the messages into a local file, later runs with the same files and contracts replay from it.
+   // Not used with cutMissing, as the sampled volumes then depend on the plotted period.
+   std::string cacheDirectory;
+   // Additional snapshot sizes and skip intervals filled in the same replay, their histograms get a suffix
+   // (e.g. histWindowLob1_100ms, histMessageLob1_skip10). Skip intervals are increased by factors of 10 if
+   // the message plot would exceed MAXBINS.
+   std::vector<TimeNS> extraSnapshotSizes;
+   std::vector<int> extraSkips;
+};
+
+// Events passed from the book stage to the fill stage
+enum class LOBEventType : char
+{
+   Message,    // per config: the effect of a book update message
+   MessageEnd, // after the Message events of all configs
+   Trade,      // a trade of the contract of the config
+   Window,     // per config: the book at a snapshot
+   WindowEnd,  // after the Window events of all configs
+   End         // end of the replay
+};
+
+struct LOBEvent
+{
+   LOBEventType type = LOBEventType::End;
+   int config = 0;              // index in the list of configs
+   TimeNS time = 0;
+   long long messageNumber = 0; // number of book update messages before this one (Message, MessageEnd, Trade)
+   long long windowTick = 0;    // number of base snapshots before this one (Window, WindowEnd)
+
+   bool sampled = false;        // Message: the book is sampled into the message plot
+   bool ownContract = false;    // Message: the message belongs to the contract of the config
+   long bidCancellations = 0;   // Message: deleted level 1 volume
+   long askCancellations = 0;
+
+   long tradeVolume = 0;        // Trade: total volume and the volume matching the best bid or ask
+   long bidTradeVolume = 0;
+   long askTradeVolume = 0;
+
+   LOBBookSample book;          // Message (if sampled) and Window, in pipelined mode. Otherwise the fill stage reads
+                                // the book directly (see LOBFillStage::fill).
+};
+
+// Fill stage: owns the histograms which do not belong to a config and fills all histograms from the events of the
+// book stage. Everything filled is allocated by setup() and serve(), so fill() does not allocate.
+struct LOBFillStage
+{
+   // configs: set up with the same snapshot sizes and skip intervals, kept by reference
+   // snapshotRatios: the snapshot sizes in units of the base snapshot size at which the Window events are emitted
+   void setup(std::vector<LOBPlotConfig>& plotConfigs, TimeNS begin, TimeNS end,
+      const std::vector<TimeNS>& sizes, const std::vector<long long>& ratios, const std::vector<int>& messageSkips,
+      long numberOfMessages, int margin)
+   {
+      configs = &plotConfigs;
+      beginTime = begin;
+      snapshotSizes = sizes;
+      snapshotRatios = ratios;
+      skips = messageSkips;
+      yBinMargin = margin;
+
+      // Construct the histogram and other objects, one per skip interval
+      histMessageCumulTime.clear();
+      histMessageTimeRatio.clear();
+      for(int m = 0; m < skips.size(); m++)
+      {
+         const std::string suffix = m == 0 ? "" : messageSeriesSuffix(skips[m]);
+         histMessageCumulTime.push_back(std::make_unique<TH1F>(("histMessageCumulTime" + suffix).c_str(), ";Message number since start of plot;#splitline{Seconds since}{  start of plot}", numberOfMessages / skips[m], 0, numberOfMessages));
+         histMessageTimeRatio.push_back(std::make_unique<TH1F>(("histMessageTimeRatio" + suffix).c_str(), ";Message number since start of plot;", numberOfMessages / skips[m], 0, numberOfMessages));
+      }
+
+      // Message numbers at the snapshots, per snapshot size, for every snapshot from begin up to and including end
+      messagePlotSnapshotPoints.assign(snapshotSizes.size(), std::vector<double>());
+      for(int w = 0; w < snapshotSizes.size(); w++)
+      {
+         messagePlotSnapshotPoints[w].reserve((end - begin) / snapshotSizes[w] + 1);
+      }
+
+      currentMessageNumber = 0;
+   }
+
+   // Publish the main series of every config on a server while they are filled
+   void serve(LiveLOBServer* liveServer)
+   {
+      server = liveServer;
+      for(auto& config : *configs)
+      {
+         // Window trades are stored as bins, message trades as message number / skip
+         auto& window = config.windows.front();
+         auto& message = config.messageSeries.front();
+         windowSeries.push_back(server->addSeries(config.index, "window", window.histWindowLob.get(), &window.spreadWindowMarker.x, &window.spreadWindowMarker.y, &window.windowTrades, 0, config.maxVolume));
+         messageSeries.push_back(server->addSeries(config.index, "message", message.histMessageLob.get(), &message.spreadMessageMarker.x, &message.spreadMessageMarker.y, &message.messageTrades, 1, config.maxVolume));
+      }
+   }
+
+   void fill(const LOBEvent& event)
+   {
+      fill(event, event.book);
+   }
+
+   // Fill an event with the book of a Message or Window event given separately, as a sample or a view of the book
+   template <class Book>
+   void fill(const LOBEvent& event, const Book& book)
+   {
+      switch(event.type)
+      {
+         case LOBEventType::Message:
+         {
+            auto& config = (*configs)[event.config];
+
+            config.bidCancellations += event.bidCancellations;
+            config.askCancellations += event.askCancellations;
+
+            if(event.sampled)
+            {
+               for(auto& series : config.messageSeries)
+               {
+                  if(event.messageNumber % series.skip == 0)
+                  {
+                     config.fillMessage(series, event.messageNumber, book, yBinMargin);
+                  }
+               }
+            }
+
+            if(event.ownContract)
+            {
+               for(auto& series : config.windows)
+               {
+                  series.numberOfMessagesSinceLastSnapshot++;
+               }
+               config.numberOfMessagesSinceStart++;
+            }
+            break;
+         }
+         case LOBEventType::MessageEnd:
+         {
+            if(server)
+            {
+               server->pace(event.time);
+            }
+
+            currentMessageNumber = event.messageNumber + 1;
+            for(int m = 0; m < skips.size(); m++)
+            {
+               if(currentMessageNumber % skips[m] == 0)
+               {
+                  histMessageCumulTime[m]->SetBinContent(1 + currentMessageNumber / skips[m], double(event.time - beginTime) / T_Second);
+               }
+
+               if(configs->size() == 2)
+               {
+                  auto& first = (*configs)[0];
+                  auto& second = (*configs)[1];
+                  //double ratio = (first.numberOfMessagesSinceStart / (double)currentMessageNumber) - (second.numberOfMessagesSinceStart / (double)currentMessageNumber);
+                  double ratio = (first.numberOfMessagesSinceStart / (double)first.messages) - (second.numberOfMessagesSinceStart / (double)second.messages);
+                  histMessageTimeRatio[m]->SetBinContent(1 + currentMessageNumber / skips[m], ratio * 10.0 + 1);
+               }
+            }
+
+            if(server)
+            {
+               for(auto handle : messageSeries)
+               {
+                  server->publish(handle, 1 + (currentMessageNumber - 1) / skips[0]);
+               }
+            }
+            break;
+         }
+         case LOBEventType::Trade:
+         {
+            auto& config = (*configs)[event.config];
+
+            config.totalTradeVolume += event.tradeVolume;
+            config.tradeVolumeSinceLastMessage += event.tradeVolume;
+            config.bidTradeVolume += event.bidTradeVolume;
+            config.askTradeVolume += event.askTradeVolume;
+            config.unexplainedTradeVolume += event.tradeVolume - event.bidTradeVolume - event.askTradeVolume;
+
+            for(auto& series : config.windows)
+            {
+               series.tradeVolumeSinceLastSnapshot += event.tradeVolume;
+               series.windowTrades.push_back(series.currentWindowNumber + 1);
+            }
+            for(auto& series : config.messageSeries)
+            {
+               series.messageTrades.push_back(static_cast<double>(event.messageNumber) / series.skip);
+            }
+            break;
+         }
+         case LOBEventType::Window:
+         {
+            auto& config = (*configs)[event.config];
+
+            for(int w = 0; w < config.windows.size(); w++)
+            {
+               if(event.windowTick % snapshotRatios[w] == 0)
+               {
+                  config.fillWindow(config.windows[w], book, yBinMargin);
+               }
+            }
+            break;
+         }
+         case LOBEventType::WindowEnd:
+         {
+            for(int w = 0; w < snapshotSizes.size(); w++)
+            {
+               if(event.windowTick % snapshotRatios[w] != 0) continue;
+
+               messagePlotSnapshotPoints[w].push_back(currentMessageNumber);
+
+               for(auto& config : *configs)
+               {
+                  auto& series = config.windows[w];
+                  series.histWindowTime->SetBinContent(series.currentWindowNumber + 1, series.numberOfMessagesSinceLastSnapshot);
+
+                  // The per snapshot values of the message plot refer to the main snapshot size
+                  if(w == 0)
+                  {
+                     for(auto& message : config.messageSeries)
+                     {
+                        for(long i = series.snapshotStartMessage; i < currentMessageNumber; i++)
+                        {
+                           if(i % message.skip == 0)
+                           {
+                              message.histMessageTrade->SetBinContent(1 + i / message.skip, series.tradeVolumeSinceLastSnapshot);
+                              message.histMessageTime->SetBinContent(1 + i / message.skip, series.numberOfMessagesSinceLastSnapshot);
+                           }
+                        }
+                     }
+                  }
+
+                  series.tradeVolumeSinceLastSnapshot = 0;
+                  series.numberOfMessagesSinceLastSnapshot = 0;
+                  series.currentWindowNumber++;
+                  series.snapshotStartMessage = currentMessageNumber;
+               }
+            }
+
+            if(server && event.windowTick % snapshotRatios[0] == 0)
+            {
+               for(auto handle : windowSeries)
+               {
+                  server->publish(handle, configs->front().windows.front().currentWindowNumber);
+               }
+            }
+            break;
+         }
+         case LOBEventType::End:
+            break;
+      }
+   }
+
+   // Write the histograms and snapshot points which do not belong to a config
+   void save(TFile& file)
+   {
+      for(int m = 0; m < skips.size(); m++)
+      {
+         file.WriteObject(histMessageCumulTime[m].get(), histMessageCumulTime[m]->GetName());
+         file.WriteObject(histMessageTimeRatio[m].get(), histMessageTimeRatio[m]->GetName());
+      }
+
+      for(int w = 0; w < snapshotSizes.size(); w++)
+      {
+         file.WriteObject(&messagePlotSnapshotPoints[w], ("messagePlotSnapshotPoints" + std::string(w == 0 ? "" : windowSeriesSuffix(snapshotSizes[w]))).c_str());
+      }
+   }
+
+   std::vector<LOBPlotConfig>* configs = nullptr;
+   TimeNS beginTime = 0;
+   std::vector<TimeNS> snapshotSizes;
+   std::vector<long long> snapshotRatios;
+   std::vector<int> skips;
+   int yBinMargin = 0;
+
+   // Number of book update messages filled so far
+   long long currentMessageNumber = 0;
+
+   std::vector<std::unique_ptr<TH1F>> histMessageCumulTime;
+   std::vector<std::unique_ptr<TH1F>> histMessageTimeRatio;
+   std::vector<std::vector<double>> messagePlotSnapshotPoints;
+
+   LiveLOBServer* server = nullptr;
+   std::vector<int> windowSeries;
+   std::vector<int> messageSeries;
+};
+
+// The book of a contract in the replay cache, the levels are stored in the entry table of the cache
+struct LOBCacheBook
+{
+   long long levels = 0; // position of the bid levels in the entry table, followed by the ask levels
+   int bidLevels = 0;
+   int askLevels = 0;
+
+   double price = 0;
+   double bidVolume = 0;
+   double askVolume = 0;
+   double apmBid = 0;
+   double apmAsk = 0;
+   double midPoint = 0;
+};
+
+enum class LOBCacheRecordKind : char
+{
+   Message, // a book update message
+   Trade    // a trade
+};
+
+// The parts of a cache record only used for messages
+struct LOBCacheMessage
+{
+   int lowestBid;       // price of the last level of each side, 0 if empty
+   int highestAsk;
+   int maxLevelVolume;  // highest volume of all levels
+   int bidDeletes;      // number of level 1 deletions of each side, stored as price and volume in the entry table
+   int askDeletes;
+   long long deletes;   // position of the bid deletions in the entry table, followed by the ask deletions
+};
+
+// The parts of a cache record only used for trades
+struct LOBCacheTrade
+{
+   int quantity;        // quantity, price and best bid and ask at the trade
+   int price;
+   bool hasBestBid;
+   bool hasBestAsk;
+   int bestBid;
+   int bestAsk;
+};
+
+// A row of the input files in the replay cache, containing everything getPeriodStats and the book stage use.
+// Every record holds the state of its contract after the row, so the samples also follow what trades change
+// (e.g. the last price). A record takes 120 bytes, the levels and deletions are stored in the entry table.
+struct LOBCacheRecord
+{
+   TimeNS time = 0;
+   int id = 0;
+   int slot = -1;               // index of the contract in the cache
+   LOBCacheRecordKind kind = LOBCacheRecordKind::Message;
+
+   LOBCacheBook book;           // the book of the contract after the row
+
+   union
+   {
+      LOBCacheMessage message;  // Message
+      LOBCacheTrade trade;      // Trade
+   };
+};
+
+// The metadata of a contract in the replay cache, so a cached replay does not need to open the input files
+struct LOBCacheSlot
+{
+   int id = -1;
+   double priceIncrease = 0;
+};
+
+using LOBCache = LOBReplayCache<LOBCacheRecord, LOBLevel, LOBCacheSlot>;
+
+// Store a sample in a cache record. The levels are added to the entry table, unless they are the same as the ones
+// of the previous book of the contract, which are shared.
+void storeCacheBook(LOBCache::Writer& writer, const LOBBookSample& sample, const LOBBookSample& previousSample, const LOBCacheBook& previousBook, LOBCacheBook& book)
+{
+   auto sameLevel = [](const LOBLevel& a, const LOBLevel& b)
+   {
+      return a.price == b.price && a.volume == b.volume;
+   };
+
+   if(sample.bidLevels == previousBook.bidLevels && sample.askLevels == previousBook.askLevels
+      && std::equal(sample.bid(), sample.bid() + sample.bidLevels, previousSample.bid(), sameLevel)
+      && std::equal(sample.ask(), sample.ask() + sample.askLevels, previousSample.ask(), sameLevel))
+   {
+      book.levels = previousBook.levels;
+   }
+   else
+   {
+      book.levels = writer.addEntries(sample.bid(), sample.bidLevels);
+      writer.addEntries(sample.ask(), sample.askLevels);
+   }
+   book.bidLevels = sample.bidLevels;
+   book.askLevels = sample.askLevels;
+
+   book.price = sample.price;
+   book.bidVolume = sample.bidVolume;
+   book.askVolume = sample.askVolume;
+   book.apmBid = sample.apmBid;
+   book.apmAsk = sample.apmAsk;
+   book.midPoint = sample.midPoint;
+}
+
+// View of a cached book with the same members as a sample, the levels are read from the mapped cache file
+struct LOBCachedBook
+{
+   LOBCachedBook(const LOBCache& cache, const LOBCacheBook& book)
+      : levels(cache.entries(book.levels)), bidLevels(book.bidLevels), askLevels(book.askLevels),
+      price(book.price), bidVolume(book.bidVolume), askVolume(book.askVolume),
+      apmBid(book.apmBid), apmAsk(book.apmAsk), midPoint(book.midPoint)
+   {
+   }
+
+   const LOBLevel& bidLevel(int i) const { return levels[i]; }
+   const LOBLevel& askLevel(int i) const { return levels[bidLevels + i]; }
+
+   const LOBLevel* levels;
+   int bidLevels;
+   int askLevels;
+
+   double price;
+   double bidVolume;
+   double askVolume;
+   double apmBid;
+   double apmAsk;
+   double midPoint;
+};
+
+// Book stage: turns the snapshots, messages and trades of a replay into events for the fill stage. In pipelined mode
+// the fill stage runs in its own thread, fed by a queue of preallocated events, otherwise every event is filled
+// immediately. Everything used during the replay is allocated by setup(), so emitting events does not allocate.
+struct LOBBookStage
+{
+   LOBBookStage() = default;
+   LOBBookStage(const LOBBookStage&) = delete;
+   LOBBookStage& operator=(const LOBBookStage&) = delete;
+
+   ~LOBBookStage()
+   {
+      stopFillThread();
+   }
+
+   // configs, fill: set up for the replay, kept by reference
+   // snapshotRatios, skips: as given to the fill stage
+   // verticalLineTimes: the message number at each of these times is recorded in verticalLinesMessage
+   void setup(std::vector<LOBPlotConfig>& plotConfigs, LOBFillStage& fillStage,
+      const std::vector<long long>& ratios, const std::vector<int>& messageSkips,
+      const std::vector<TimeNS>& verticalLineTimes, bool pipelined)
+   {
+      stopFillThread();
+
+      configs = &plotConfigs;
+      fill = &fillStage;
+      snapshotRatios = ratios;
+      skips = messageSkips;
+      verticalLines = verticalLineTimes;
+
+      messageNumber = 0;
+      windowTick = 0;
+      verticalLineIndex = 0;
+      verticalLinesMessage.clear();
+      verticalLinesMessage.reserve(verticalLines.size());
+      contractStarted.assign(configs->size(), false);
+
+      // A cache has at most one slot per config
+      lastOfSlot.reserve(configs->size());
+
+      pipeline.reset();
+      if(pipelined)
+      {
+         // The book samples of all events hold the deepest book of all configs
+         int maxDepth = 0;
+         for(auto& config : *configs)
+         {
+            maxDepth = std::max(maxDepth, config.maxDepth);
+         }
+         LOBEvent eventPrototype;
+         eventPrototype.book.reserve(maxDepth);
+
+         pipeline = std::make_unique<SPSCQueue<LOBEvent>>(PIPELINECAPACITY, eventPrototype);
+         fillError = nullptr;
+         stopping = false;
+         fillThread = std::thread([this]()
+         {
+            for(;;)
+            {
+               const LOBEvent& event = pipeline->front();
+               if(event.type == LOBEventType::End && stopping)
+               {
+                  pipeline->pop();
+                  break;
+               }
+
+               // After an error keep draining the queue, so the book stage does not block
+               if(!fillError)
+               {
+                  try
+                  {
+                     fill->fill(event);
+                  }
+                  catch(...)
+                  {
+                     fillError = std::current_exception();
+                  }
+               }
+               pipeline->pop();
+            }
+         });
+      }
+   }
+
+   // Wait until all events are filled, rethrows an error of the fill thread. The fill thread keeps running until
+   // the book stage is destroyed or set up again, so finishing neither frees nor allocates memory.
+   void finish()
+   {
+      if(fillThread.joinable())
+      {
+         nextEvent().type = LOBEventType::End;
+         commitEvent();
+         pipeline->flush();
+      }
+      if(fillError)
+      {
+         std::exception_ptr error = fillError;
+         fillError = nullptr;
+         std::rethrow_exception(error);
+      }
+   }
+
+   // sample(i, use) calls use(book) with the book of config i, a sample or a view of the book (see replay())
+   template <class Sample>
+   void emitWindow(TimeNS time, const Sample& sample)
+   {
+      const long long tick = windowTick++;
+
+      // Only sample the books if at least one of the snapshot sizes is due
+      bool due = false;
+      for(auto ratio : snapshotRatios)
+      {
+         due = due || tick % ratio == 0;
+      }
+      if(!due) return;
+
+      for(int i = 0; i < configs->size(); i++)
+      {
+         auto& event = nextEvent();
+         event.type = LOBEventType::Window;
+         event.config = i;
+         event.time = time;
+         event.windowTick = tick;
+         commitBookEvent(i, sample);
+      }
+
+      auto& event = nextEvent();
+      event.type = LOBEventType::WindowEnd;
+      event.time = time;
+      event.windowTick = tick;
+      commitEvent();
+   }
+
+   // cancellations(config, event) adds the level 1 deletions of the message to the event of a config
+   template <class Cancellations, class Sample>
+   void emitMessage(int id, TimeNS time, const Cancellations& cancellations, const Sample& sample)
+   {
+      for(int i = 0; i < configs->size(); i++)
+      {
+         const auto& config = (*configs)[i];
+
+         auto& event = nextEvent();
+         event.type = LOBEventType::Message;
+         event.config = i;
+         event.time = time;
+         event.messageNumber = messageNumber;
+         event.bidCancellations = 0;
+         event.askCancellations = 0;
+
+         cancellations(config, event);
+
+         event.sampled = false;
+         for(auto messageSkip : skips)
+         {
+            event.sampled = event.sampled || messageNumber % messageSkip == 0;
+         }
+         event.ownContract = id == config.contractID;
+         if(event.sampled) commitBookEvent(i, sample);
+         else commitEvent();
+      }
+
+      auto& event = nextEvent();
+      event.type = LOBEventType::MessageEnd;
+      event.time = time;
+      event.messageNumber = messageNumber;
+      commitEvent();
+
+      messageNumber++;
+   }
+
+   void emitTrade(int id, TimeNS time, long quantity, bool atBestBid, bool atBestAsk)
+   {
+      for(int i = 0; i < configs->size(); i++)
+      {
+         if(id == (*configs)[i].contractID)
+         {
+            auto& event = nextEvent();
+            event.type = LOBEventType::Trade;
+            event.config = i;
+            event.time = time;
+            event.messageNumber = messageNumber;
+            event.tradeVolume = quantity;
+            event.bidTradeVolume = 0;
+            event.askTradeVolume = 0;
+
+            if(atBestBid)
+            {
+               event.bidTradeVolume = quantity;
+            }
+            else if(atBestAsk)
+            {
+               event.askTradeVolume = quantity;
+            }
+
+            commitEvent();
+         }
+      }
+   }
+
+   // Add a level 1 deletion to the cancellations of a config
+   static void addCancellation(const LOBPlotConfig& config, LOBEvent& event, bool bid, int price, long volume)
+   {
+      if(bid)
+      {
+         if(price >= config.low)
+         {
+            event.bidCancellations += volume;
+         }
+      }
+      else
+      {
+         if(price <= config.high)
+         {
+            event.askCancellations += volume;
+         }
+      }
+   }
+
+   // Record the message number at the next vertical line once it is reached
+   void checkVerticalLines(TimeNS time)
+   {
+      if(verticalLineIndex < verticalLines.size())
+      {
+         if(verticalLines[verticalLineIndex] - time <= 0)
+         {
+            verticalLinesMessage.push_back(messageNumber);
+            verticalLineIndex++;
+         }
+      }
+   }
+
+   // Until the first book update message or trade of its contract, a config is sampled as emptyBook, as the
+   // cache has no record of the contract yet (see LOBCacheRecord). Both replays give the same samples this way.
+   void startContract(int id)
+   {
+      for(int i = 0; i < configs->size(); i++)
+      {
+         if((*configs)[i].contractID == id) contractStarted[i] = true;
+      }
+   }
+
+   // Replay of a cache from beginTime to endTime, cacheSlots holds the slot of the contract of each config. The books
+   // of the configs are the cached books after the last row of their contract. As in the windower, a snapshot is
+   // taken every baseSnapshotSize, before the first row at or after the snapshot time.
+   void replay(const LOBCache& cache, const std::vector<int>& cacheSlots, TimeNS beginTime, TimeNS endTime, TimeNS baseSnapshotSize)
+   {
+      auto sampleCache = [&](int i, const auto& use)
+      {
+         const long long last = lastOfSlot[cacheSlots[i]];
+         if(last >= 0) use(LOBCachedBook(cache, cache.at(last).book));
+         else use(emptyBook);
+      };
+
+      TimeNS nextWindow = (beginTime + baseSnapshotSize - 1) / baseSnapshotSize * baseSnapshotSize;
+      auto windowsUntil = [&](TimeNS time)
+      {
+         for(; nextWindow <= time; nextWindow += baseSnapshotSize)
+         {
+            emitWindow(nextWindow, sampleCache);
+         }
+      };
+
+      for(auto i = cache.seek(beginTime, lastOfSlot); i < cache.size(); i++)
+      {
+         const auto& record = cache.at(i);
+         if(record.time > endTime) break;
+
+         windowsUntil(record.time);
+         checkVerticalLines(record.time);
+
+         lastOfSlot[record.slot] = i;
+
+         if(record.kind == LOBCacheRecordKind::Message)
+         {
+            const LOBLevel* deletes = cache.entries(record.message.deletes);
+            emitMessage(record.id, record.time, [&](const LOBPlotConfig& config, LOBEvent& event)
+            {
+               for(int d = 0; d < record.message.bidDeletes + record.message.askDeletes; d++)
+               {
+                  addCancellation(config, event, d < record.message.bidDeletes, deletes[d].price, deletes[d].volume);
+               }
+            }, sampleCache);
+         }
+         else
+         {
+            emitTrade(record.id, record.time, record.trade.quantity,
+               record.trade.hasBestBid && record.trade.bestBid == record.trade.price,
+               record.trade.hasBestAsk && record.trade.bestAsk == record.trade.price);
+         }
+      }
+
+      // The snapshots after the last row, also if the cache ends before endTime
+      windowsUntil(endTime);
+   }
+
+   // Number of book update messages emitted so far
+   long long messageNumber = 0;
+   // Number of base snapshots emitted so far
+   long long windowTick = 0;
+
+   std::vector<char> contractStarted;
+   LOBBookSample emptyBook;
+
+   std::vector<double> verticalLinesMessage;
+
+private:
+   // The book stage writes its events directly into the queue, or into a single event which is filled immediately
+   LOBEvent& nextEvent()
+   {
+      return pipeline ? pipeline->back() : serialEvent;
+   }
+
+   void commitEvent()
+   {
+      if(pipeline) pipeline->push();
+      else fill->fill(serialEvent);
+   }
+
+   // In pipelined mode the book is copied into the event, otherwise the fill stage reads it directly, avoiding the copy
+   template <class Sample>
+   void commitBookEvent(int i, const Sample& sample)
+   {
+      if(pipeline)
+      {
+         sample(i, [&](const auto& book)
+         {
+            pipeline->back().book.assign(book);
+         });
+         pipeline->push();
+      }
+      else
+      {
+         sample(i, [&](const auto& book)
+         {
+            fill->fill(serialEvent, book);
+         });
+      }
+   }
+
+   // Fill the remaining events and end the fill thread
+   void stopFillThread()
+   {
+      if(fillThread.joinable())
+      {
+         stopping = true;
+         nextEvent().type = LOBEventType::End;
+         commitEvent();
+         fillThread.join();
+      }
+   }
+
+   std::vector<LOBPlotConfig>* configs = nullptr;
+   LOBFillStage* fill = nullptr;
+   std::vector<long long> snapshotRatios;
+   std::vector<int> skips;
+
+   std::vector<TimeNS> verticalLines;
+   int verticalLineIndex = 0;
+
+   std::vector<long long> lastOfSlot;
+
+   LOBEvent serialEvent;
+   std::unique_ptr<SPSCQueue<LOBEvent>> pipeline;
+   std::thread fillThread;
+   std::atomic<bool> stopping{false};
+   std::exception_ptr fillError;
+};
+
+// Convert all messages of the contracts in the input files into a replay cache, slotConfigs holds one config per contract
+void buildReplayCache(const std::string& cachePath, const std::string& key, const std::vector<std::unique_ptr<TFile>>& files, MetaData_t& metaData, const std::vector<LOBPlotConfig>& slotConfigs)
+{
+   Windower<> windower;
+   for(auto& file : files)
+   {
+      windower.addTree(file.get(), "Messages");
+   }
+
+   std::set<int> ids;
+   std::map<int, int> slots;
+   for(int slot = 0; slot < slotConfigs.size(); slot++)
+   {
+      ids.insert(slotConfigs[slot].contractID);
+      slots[slotConfigs[slot].contractID] = slot;
+   }
+
+   windower.setIdFilter(ids);
+   windower.setDefaultStateInitializerAndUpdater(&metaData);
+
+   std::vector<LOBCacheSlot> slotData(slotConfigs.size());
+   for(int slot = 0; slot < slotConfigs.size(); slot++)
+   {
+      slotData[slot].id = slotConfigs[slot].contractID;
+      slotData[slot].priceIncrease = slotConfigs[slot].priceIncrease;
+   }
+
+   LOBCache::Writer writer(cachePath, key, slotData);
+   LOBCacheRecord record;
+   std::vector<LOBLevel> bidDeletes;
+   std::vector<LOBLevel> askDeletes;
+
+   // The last sample and cached book of each contract, the levels of a record are only stored if they changed
+   std::vector<LOBBookSample> samples(slotConfigs.size());
+   std::vector<LOBCacheBook> books(slotConfigs.size());
+   LOBBookSample sample;
+
+   // The state of the contract after the row, written with the record
+   auto addRecord = [&](const Security& security)
+   {
+      auto bidBook = security.getBook(BookSide::BidConsolidated);
+      auto askBook = security.getBook(BookSide::AskConsolidated);
+
+      // The samples grow with the deepest book, the cache stores every level
+      const int depth = std::max<int>(bidBook->size(), askBook->size());
+      if(depth > sample.depth) sample.reserve(depth);
+
+      slotConfigs[record.slot].sampleBook(security, false, sample);
+      storeCacheBook(writer, sample, samples[record.slot], books[record.slot], record.book);
+      writer.add(record);
+
+      std::swap(samples[record.slot], sample);
+      books[record.slot] = record.book;
+   };
+
+   windower.setForEachRow([&](int id, TimeNS time, const MRow& row, const Security& security)
+   {
+      if(row.messageKind >= (char)MessageKind::BidNew
+         && row.messageKind <= (char)MessageKind::AskDelete)
+      {
+         record = LOBCacheRecord();
+         record.time = time;
+         record.id = id;
+         record.slot = slots.at(id);
+         record.kind = LOBCacheRecordKind::Message;
+
+         bidDeletes.clear();
+         askDeletes.clear();
+         for(auto a : *security.getLastUpdateActions())
+         {
+            if(a.actionType == ActionType::DeleteAction && a.level == 1)
+            {
+               (a.side == Side::Bid ? bidDeletes : askDeletes).push_back(LOBLevel{a.price, a.volume});
+            }
+         }
+         record.message.deletes = writer.addEntries(bidDeletes.data(), bidDeletes.size());
+         writer.addEntries(askDeletes.data(), askDeletes.size());
+         record.message.bidDeletes = bidDeletes.size();
+         record.message.askDeletes = askDeletes.size();
+
+         auto bidBook = security.getBook(BookSide::BidConsolidated);
+         auto askBook = security.getBook(BookSide::AskConsolidated);
+         record.message.lowestBid = bidBook->empty() ? 0 : bidBook->back().price;
+         record.message.highestAsk = askBook->empty() ? 0 : askBook->back().price;
+         for(auto level : *bidBook)
+         {
+            record.message.maxLevelVolume = std::max<int>(record.message.maxLevelVolume, level.volume);
+         }
+         for(auto level : *askBook)
+         {
+            record.message.maxLevelVolume = std::max<int>(record.message.maxLevelVolume, level.volume);
+         }
+
+         addRecord(security);
+      }
+      else if (row.messageKind == static_cast<char>(MessageKind::Trade)
+         && row.quoteCondition == static_cast<char>(QuoteCondition::Trade))
+      {
+         auto bidBook = security.getBook(BookSide::BidConsolidated);
+         auto askBook = security.getBook(BookSide::AskConsolidated);
+
+         record = LOBCacheRecord();
+         record.time = time;
+         record.id = id;
+         record.slot = slots.at(id);
+         record.kind = LOBCacheRecordKind::Trade;
+         record.trade.quantity = row.quantity;
+         record.trade.price = row.price;
+         record.trade.hasBestBid = bidBook->size() >= 1;
+         record.trade.hasBestAsk = askBook->size() >= 1;
+         record.trade.bestBid = record.trade.hasBestBid ? bidBook->at(0).price : 0;
+         record.trade.bestAsk = record.trade.hasBestAsk ? askBook->at(0).price : 0;
+
+         addRecord(security);
+      }
+   });
+
+   windower.run();
+   writer.finish();
+}
+
+// Open the replay cache of the input files and contracts of the configs in a directory, building it if it does not exist yet.
+// configSlots is set to the slot of the contract of each config, and the contract ID and price increase of the configs
+// are set from the cache. The input files are only opened to build the cache. Returns nullptr if the cache cannot be used.
+std::unique_ptr<LOBCache> openReplayCache(std::vector<LOBPlotConfig>& configs, const std::string& rootPath, const std::string& directory, std::vector<int>& configSlots)
+{
+   std::set<std::string> fileNames;
+   std::map<std::string, double> dollarValues;
+
+   for(auto& config : configs)
+   {
+      fileNames.insert(config.fileName);
+
+      // The APM of the cached books is calculated for a single dollar value per contract
+      auto known = dollarValues.find(config.contract);
+      if(known != dollarValues.end() && known->second != config.dollarValue)
+      {
+         std::cout << "Different dollar values for " << config.contract << ", not using the replay cache\n";
+         return nullptr;
+      }
+      dollarValues[config.contract] = config.dollarValue;
+   }
+
+   // The cache is keyed by the input files (including their size and modification time) and the contracts
+   std::ostringstream key;
+   key << std::setprecision(17);
+
+   for(auto& fileName : fileNames)
+   {
+      const std::string filePath = rootPath + "/" + fileName;
+      FileStat_t info;
+      if(gSystem->GetPathInfo(filePath.c_str(), info) != 0) throw std::invalid_argument("Could not open " + filePath);
+
+      key << "file " << filePath << " " << info.fSize << " " << info.fMtime << "\n";
+   }
+   for(auto& contract : dollarValues)
+   {
+      key << "contract " << contract.first << " " << contract.second << "\n";
+   }
+
+   configSlots.clear();
+   for(auto& config : configs)
+   {
+      configSlots.push_back(std::distance(dollarValues.begin(), dollarValues.find(config.contract)));
+   }
+
+   const std::string cachePath = LOBCache::path(directory, key.str());
+   auto cache = std::make_unique<LOBCache>();
+
+   if(cache->open(cachePath, key.str()))
+   {
+      std::cout << "Using replay cache " << cachePath << "\n";
+   }
+   else
+   {
+      std::cout << "Creating replay cache " << cachePath << "\n";
+
+      std::vector<std::unique_ptr<TFile>> files;
+      MetaData_t metaData;
+      for(auto& fileName : fileNames)
+      {
+         const std::string filePath = rootPath + "/" + fileName;
+         files.push_back(std::make_unique<TFile>(filePath.c_str()));
+         if (!files.back() || files.back()->IsZombie()) throw std::invalid_argument("Could not open " + filePath);
+
+         ReadMetaData(*files.back(), metaData);
+      }
+
+      std::vector<LOBPlotConfig> slotConfigs;
+      for(auto& contract : dollarValues)
+      {
+         slotConfigs.emplace_back();
+         auto& slotConfig = slotConfigs.back();
+         slotConfig.contract = contract.first;
+         slotConfig.dollarValue = contract.second;
+         slotConfig.contractID = MetaDataGetID(metaData, contract.first);
+         if(slotConfig.contractID == -1) throw std::runtime_error("ID not found");
+         slotConfig.priceIncrease = metaData.at(slotConfig.contractID).PriceIncrease;
+      }
+
+      try
+      {
+         buildReplayCache(cachePath, key.str(), files, metaData, slotConfigs);
+      }
+      catch(const std::exception& e)
+      {
+         std::cout << "Could not create the replay cache: " << e.what() << "\n";
+         return nullptr;
+      }
+
+      if(!cache->open(cachePath, key.str())) return nullptr;
+   }
+
+   for(int i = 0; i < configs.size(); i++)
+   {
+      const auto& slot = cache->slot(configSlots[i]);
+      configs[i].contractID = slot.id;
+      configs[i].priceIncrease = slot.priceIncrease;
+   }
+
+   return cache;
+}
+
+// Function to calculate some of the required parameters, runs before the main loop. Should not be called by user.
+// With a replay cache the statistics are read from the cache instead of the input files.
+// The depth of the books is taken up to endTime, including the books before beginTime which are sampled at its start.
+void getPeriodStats(std::vector<LOBPlotConfig>& configs, TimeNS beginTime, TimeNS endTime, const std::string &rootPath, bool cutMissing, const LOBCache* cache = nullptr)
+{
+   std::set<std::string> fileNames;
+   std::set<int> ids;
+
    for(auto& config : configs)
    {
-      config.contractID = MetaDataGetID(metaData, config.contract);
-      if(config.contractID == -1) throw std::runtime_error("ID not found");
-      ids.insert(config.contractID);
+      fileNames.insert(config.fileName);
    }
 
-   windower.setIdFilter(ids);
-   windower.setDefaultStateInitializerAndUpdater(&metaData);
+   std::vector<std::unique_ptr<TFile>> files;
+   Windower<> windower;
+   MetaData_t metaData;
+
+   // With a replay cache the input files are not opened, the contract IDs were set from the cache by openReplayCache
+   if(!cache)
+   {
+      for(auto& fileName : fileNames)
+      {
+         std::string filePath = rootPath + "/" + fileName;
+         files.push_back(std::make_unique<TFile>(filePath.c_str()));
+         if (!files.back()) throw std::invalid_argument("Could not open " + filePath);
+
+         ReadMetaData(*files.back(), metaData);
+         windower.addTree(files.back().get(), "Messages");
+      }
+
+      for(auto& config : configs)
+      {
+         config.contractID = MetaDataGetID(metaData, config.contract);
+         if(config.contractID == -1) throw std::runtime_error("ID not found");
+         ids.insert(config.contractID);
+      }
+
+      windower.setIdFilter(ids);
+      windower.setDefaultStateInitializerAndUpdater(&metaData);
+   }
 
    if(cutMissing)
    {
@@ -371,68 +1752,145 @@ void getPeriodStats(std::vector<LOBPlotConfig>& configs, TimeNS beginTime, TimeN
       }
    }
 
-   windower.setForEachRow([&](int id, TimeNS time, const MRow& row, const Security& security)
+   // Update the book depth of the configs of a contract
+   auto addDepth = [&](int id, int depth)
    {
-      if (beginTime <= time && time <= endTime)
+      for(auto& config : configs)
+      {
+         if(config.contractID == id)
+         {
+            config.maxDepth = std::max(config.maxDepth, depth);
+         }
+      }
+   };
+
+   // Update the statistics of the configs of a contract with the book after one of its messages
+   auto addMessage = [&](int id, int localLow, int localHigh, int maxLevelVolume)
+   {
+      for(auto& config : configs)
       {
-         if(row.messageKind >= (char)MessageKind::BidNew
-            && row.messageKind <= (char)MessageKind::AskDelete)
+         if(config.contractID == id)
          {
-            for(auto& config : configs)
+            config.messages++;
+
+            if(!cutMissing)
+            {
+               if(localLow != 0 && localLow < config.low)
+               {
+                  config.low = localLow;
+               }
+
+               if(localHigh != 0 && localHigh > config.high)
+               {
+                  config.high = localHigh;
+               }
+            }
+            else
             {
-               if(config.contractID == id)
+               if(localLow != 0 && localLow > config.low)
                {
-                  config.messages++;
+                  config.low = localLow;
+               }
 
-                  int localLow = security.getBook(BookSide::BidConsolidated)->back().price;
-                  int localHigh = security.getBook(BookSide::AskConsolidated)->back().price;
+               if(localHigh != 0 && localHigh < config.high)
+               {
+                  config.high = localHigh;
+               }
+            }
 
-                  if(!cutMissing)
-                  {
-                     if(localLow != 0 && localLow < config.low)
-                     {
-                        config.low = localLow;
-                     }
+            if(maxLevelVolume > config.maxVolume)
+            {
+               config.maxVolume = maxLevelVolume;
+            }
+         }
+      }
+   };
 
-                     if(localHigh != 0 && localHigh > config.high)
-                     {
-                        config.high = localHigh;
-                     }
-                  }
-                  else
-                  {
-                     if(localLow != 0 && localLow > config.low)
-                     {
-                        config.low = localLow;
-                     }
+   // Count the trades, to reserve the trade buffers
+   auto addTrade = [&](int id)
+   {
+      for(auto& config : configs)
+      {
+         if(config.contractID == id)
+         {
+            config.trades++;
+         }
+      }
+   };
 
-                     if(localHigh != 0 && localHigh < config.high)
-                     {
-                        config.high = localHigh;
-                     }
-                  }
+   if(cache)
+   {
+      std::vector<long long> lastOfSlot;
+      auto i = cache->seek(beginTime, lastOfSlot);
+      for(auto last : lastOfSlot)
+      {
+         if(last >= 0)
+         {
+            const auto& record = cache->at(last);
+            addDepth(record.id, std::max(record.book.bidLevels, record.book.askLevels));
+         }
+      }
+
+      for(; i < cache->size() && cache->at(i).time <= endTime; i++)
+      {
+         const auto& record = cache->at(i);
+         addDepth(record.id, std::max(record.book.bidLevels, record.book.askLevels));
+
+         if(record.kind == LOBCacheRecordKind::Message)
+         {
+            addMessage(record.id, record.message.lowestBid, record.message.highestAsk, record.message.maxLevelVolume);
+         }
+         else
+         {
+            addTrade(record.id);
+         }
+      }
+   }
+   else
+   {
+      windower.setForEachRow([&](int id, TimeNS time, const MRow& row, const Security& security)
+      {
+         if (time <= endTime)
+         {
+            addDepth(id, std::max<int>(security.getBook(BookSide::BidConsolidated)->size(), security.getBook(BookSide::AskConsolidated)->size()));
+         }
+
+         if (beginTime <= time && time <= endTime)
+         {
+            if(row.messageKind >= (char)MessageKind::BidNew
+               && row.messageKind <= (char)MessageKind::AskDelete)
+            {
+               int localLow = security.getBook(BookSide::BidConsolidated)->back().price;
+               int localHigh = security.getBook(BookSide::AskConsolidated)->back().price;
 
-                  for(auto level : *security.getBook(BookSide::BidConsolidated))
+               int maxLevelVolume = 0;
+               for(auto level : *security.getBook(BookSide::BidConsolidated))
+               {
+                  if(level.volume > maxLevelVolume)
                   {
-                     if(level.volume > config.maxVolume)
-                     {
-                        config.maxVolume = level.volume;
-                     }
+                     maxLevelVolume = level.volume;
                   }
-                  for(auto level : *security.getBook(BookSide::AskConsolidated))
+               }
+               for(auto level : *security.getBook(BookSide::AskConsolidated))
+               {
+                  if(level.volume > maxLevelVolume)
                   {
-                     if(level.volume > config.maxVolume)
-                     {
-                        config.maxVolume = level.volume;
-                     }
+                     maxLevelVolume = level.volume;
                   }
                }
+
+               addMessage(id, localLow, localHigh, maxLevelVolume);
+            }
+            else if (row.messageKind == static_cast<char>(MessageKind::Trade)
+               && row.quoteCondition == static_cast<char>(QuoteCondition::Trade))
+            {
+               addTrade(id);
             }
          }
-      }
-   });
+      });
 
-   windower.run();
+      windower.run();
+   }
 }
 
 // Main function collecting the plot data
@@ -446,6 +1904,12 @@ void getPeriodStats(std::vector<LOBPlotConfig>& configs, TimeNS beginTime, TimeN
 //    configs: a list of different configurations to be made, each element is an object as defined above
 //    verticalLines: time and name of the vertical lines to be overlayed
 //    cutMissing: boolean to control the min and max price of the plot
+//    options: optional parameters, as defined above
+// The work is split into a book stage, which runs in the windower callbacks and turns every message into compact
+// events, and a fill stage, which fills the histograms from these events. In pipelined mode the fill stage runs
+// in its own thread and ROOT decompresses the input in parallel, otherwise the events are filled immediately, with
+// the fill stage reading the books directly. Decoding the rows is part of the windower and stays in the book stage
+// thread, so the pipeline has two stages; the parallel decompression only takes the unzipping off that thread.
 void GenerateLiveLOBPlot(const std::string &rootPath,
    const std::string& outputFileName,
    const TimeNS beginTime, const TimeNS endTime, 
@@ -453,22 +1917,71 @@ void GenerateLiveLOBPlot(const std::string &rootPath,
    const TimeNS snapshotSize, 
    std::vector<LOBPlotConfig>& configs,
    std::vector<std::pair<TimeNS, std::string>> verticalLines,
-   bool cutMissing)
+   bool cutMissing,
+   const LOBGeneratorOptions& options = LOBGeneratorOptions())
 {
-   // Calculate parameters based on the configuration
-   if(beginTime % snapshotSize != 0)
+   // The snapshot sizes to fill, the first one is the main one
+   std::vector<TimeNS> snapshotSizes = {snapshotSize};
+   for(auto size : options.extraSnapshotSizes)
+   {
+      if(size <= 0) throw std::invalid_argument("Snapshot size must be positive");
+      if(std::find(snapshotSizes.begin(), snapshotSizes.end(), size) == snapshotSizes.end())
+      {
+         snapshotSizes.push_back(size);
+      }
+   }
+
+   // The windower runs at the greatest common divisor of the snapshot sizes, every series fills on a multiple of it
+   TimeNS baseSnapshotSize = 0;
+   for(auto size : snapshotSizes)
+   {
+      baseSnapshotSize = std::gcd(baseSnapshotSize, size);
+   }
+   std::vector<long long> snapshotRatios;
+   for(auto size : snapshotSizes)
    {
-      std::cout << "Begin time is alligned with the snapshot series, undefined behaviour!\n";
+      snapshotRatios.push_back(size / baseSnapshotSize);
    }
-   if(endTime % snapshotSize != 0)
+
+   // Calculate parameters based on the configuration
+   for(auto size : snapshotSizes)
    {
-      std::cout << "End time is alligned with the snapshot series, undefined behaviour!\n";
+      if(beginTime % size != 0)
+      {
+         std::cout << "Begin time is alligned with the snapshot series, undefined behaviour!\n";
+      }
+      if(endTime % size != 0)
+      {
+         std::cout << "End time is alligned with the snapshot series, undefined behaviour!\n";
+      }
    }
 
    const long numberOfBinsWindowHist = (endTime - beginTime) / snapshotSize;
 
+   // Replay from the local cache if enabled
+   std::unique_ptr<LOBCache> cache;
+   std::vector<int> cacheSlots;
+   if(!options.cacheDirectory.empty())
+   {
+      if(cutMissing)
+      {
+         std::cout << "The replay cache is not used with cutMissing\n";
+      }
+      else
+      {
+         cache = openReplayCache(configs, rootPath, options.cacheDirectory, cacheSlots);
+      }
+   }
+
    // Gather the minimum and maximum price within the specified window
-   getPeriodStats(configs, beginTime, endTime, rootPath, cutMissing);
+   getPeriodStats(configs, beginTime, endTime, rootPath, cutMissing, cache.get());
+
+   // The deepest book of all configs, the size of the book samples in pipelined mode
+   int maxDepth = 0;
+   for(auto& config : configs)
+   {
+      maxDepth = std::max(maxDepth, config.maxDepth);
+   }
 
    // Continue calculating parameters 
    long numberOfMessages = 0;
@@ -496,12 +2009,37 @@ void GenerateLiveLOBPlot(const std::string &rootPath,
       skip *= 10;
    }
 
+   // The skip intervals to fill, the first one is the main one
+   std::vector<int> skips = {skip};
+   for(auto extraSkip : options.extraSkips)
+   {
+      if(extraSkip <= 0) throw std::invalid_argument("Skip interval must be positive");
+      while(numberOfMessages / extraSkip * verticalNumberOfBins > MAXBINS)
+      {
+         extraSkip *= 10;
+      }
+      if(std::find(skips.begin(), skips.end(), extraSkip) == skips.end())
+      {
+         skips.push_back(extraSkip);
+      }
+   }
+
    std::cout << "Number of messages: " << numberOfMessages 
       << ", number of snapshots: " << numberOfBinsWindowHist 
       << ", skip interval: " << skip
       << ", number of horizontal time bins: " <<  numberOfMessages / skip
       << ", max vertical range: " << maxVerticalRange 
-      << ", max volume: " << maxVolume << "\n";
+      << ", max volume: " << maxVolume
+      << ", max book depth: " << maxDepth << "\n";
+
+   for(int w = 1; w < snapshotSizes.size(); w++)
+   {
+      std::cout << "Additional snapshot size: " << snapshotSizes[w] << " ns, number of snapshots: " << (endTime - beginTime) / snapshotSizes[w] << "\n";
+   }
+   for(int m = 1; m < skips.size(); m++)
+   {
+      std::cout << "Additional skip interval: " << skips[m] << ", number of horizontal time bins: " << numberOfMessages / skips[m] << "\n";
+   }
 
    std::set<std::string> fileNames;
    std::set<int> ids;
@@ -515,9 +2053,11 @@ void GenerateLiveLOBPlot(const std::string &rootPath,
    Windower<> windower;
    MetaData_t metaData;
 
+   // A cached replay does not read the input files, the metadata of the contracts is stored in the cache
    for(auto& fileName : fileNames)
    {
       std::cout << "Unique file: " << fileName << "\n";
+      if(cache) continue;
 
       std::string filePath = rootPath + "/" + fileName;
       files.push_back(std::make_unique<TFile>(filePath.c_str()));
@@ -532,291 +2072,137 @@ void GenerateLiveLOBPlot(const std::string &rootPath,
    int yBinMargin = cutMissing ? 0 : 3;
    for(auto& config : configs)
    {
+      if(cache) config.setupSeries(skips, titleCopy, endTime - beginTime, numberOfMessages, snapshotSizes, index, yBinMargin);
+      else config.setup(metaData, skips, titleCopy, endTime - beginTime, numberOfMessages, snapshotSizes, index, yBinMargin);
+
       std::cout << config.contract << "=" << config.contractID
          << ", low (ticks): " << config.low
          << ", high (ticks): " << config.high
          << std::setprecision(5)
-         << ", low: " << config.low * metaData[config.contractID].PriceIncrease
-         << ", high: " << config.high * metaData[config.contractID].PriceIncrease
-         << ", tick size: " << metaData[config.contractID].PriceIncrease
+         << ", low: " << config.low * config.priceIncrease
+         << ", high: " << config.high * config.priceIncrease
+         << ", tick size: " << config.priceIncrease
          << ", messages: " << config.messages
          << ", dollar value:" << config.dollarValue
          << "\n";
 
-      config.setup(metaData, skip, titleCopy, numberOfBinsWindowHist, numberOfMessages, snapshotSize, index, yBinMargin);
       titleCopy = "";
       index++;
       ids.insert(config.contractID);
    }
 
-   // Construct the histogram and other objects
-   auto histMessageCumulTime = std::make_unique<TH1F>("histMessageCumulTime", ";Message number since start of plot;#splitline{Seconds since}{  start of plot}", numberOfMessages / skip, 0, numberOfMessages);
-   auto histMessageTimeRatio = std::make_unique<TH1F>("histMessageTimeRatio", ";Message number since start of plot;", numberOfMessages / skip, 0, numberOfMessages);
-
-   windower.setIdFilter(ids);
-   windower.setDefaultStateInitializerAndUpdater(&metaData);
-
-   long long currentMessageNumber = 0;
-   long long currentWindowNumber = 0;
-   long snapshotStartMessage = 0;
+   if(!cache)
+   {
+      windower.setIdFilter(ids);
+      windower.setDefaultStateInitializerAndUpdater(&metaData);
+   }
 
-   std::vector<double> messagePlotSnapshotPoints;
    std::vector<double> verticalLinesWindow;
-   std::vector<double> verticalLinesMessage;
+   std::vector<TimeNS> verticalLineTimes;
    std::vector<std::string> verticalLinesTitle;
-   int verticalLineIndex = 0;
 
    for(auto vl : verticalLines)
    {
       verticalLinesWindow.push_back(static_cast<double>(vl.first - beginTime) / T_Second);
+      verticalLineTimes.push_back(vl.first);
       verticalLinesTitle.push_back(vl.second);
    }
 
-   // Apply for each snapshot --> snapshot based plot
-   windower.setStateWindowAction(snapshotSize, [&](TimeNS time, const std::map<int, Security>& securities)
-   {
-      if (beginTime <= time && time <= endTime)
-      {
-         messagePlotSnapshotPoints.push_back(currentMessageNumber);
-
-         for(auto& config : configs)
-         {
-            auto FillLevel = [&](std::unique_ptr<TH2F>& hist, int id, BookSide side)
-            {
-               auto book = securities.at(id).getBook(side);
-               for (auto &&level : *book)
-               {
-                  if (level.price > 0)
-                  {
-                     //hist->Fill((double) currentWindowNumber * snapshotSize / T_Second,
-                     //   level.price * metaData[id].PriceIncrease,
-                     //   level.volume);
-                     hist->SetBinContent(currentWindowNumber + 1,
-                              level.price - config.low + yBinMargin + 1,
-                              level.volume);
-                  }
-               }
-            };
-
-            FillLevel(config.histWindowLob, config.contractID, BookSide::BidConsolidated);
-            FillLevel(config.histWindowLob, config.contractID, BookSide::AskConsolidated);
-
-            config.histWindowTrade->SetBinContent(currentWindowNumber + 1, config.tradeVolumeSinceLastSnapshot);
-            config.histWindowCumulTrade->SetBinContent(currentWindowNumber + 1, config.totalTradeVolume);
-            config.histWindowCumulTradeBid->SetBinContent(currentWindowNumber + 1, config.bidTradeVolume);
-            config.histWindowCumulTradeAsk->SetBinContent(currentWindowNumber + 1, config.askTradeVolume);
-            config.histWindowPrice->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getPrice() * metaData[config.contractID].PriceIncrease);
-
-            if(!cutMissing)
-            {
-               config.histWindowBidVolume->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getVolume(BookSide::BidConsolidated));
-               config.histWindowAskVolume->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getVolume(BookSide::AskConsolidated));
-            }
-            else
-            {
-               config.histWindowBidVolume->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getVolume(BookSide::BidConsolidated, config.low));
-               config.histWindowAskVolume->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getVolume(BookSide::AskConsolidated, config.high));
-            }
-
-            config.histWindowCancellationsBid->SetBinContent(currentWindowNumber + 1, config.bidCancellations);
-            config.histWindowCancellationsAsk->SetBinContent(currentWindowNumber + 1, config.askCancellations);
-
-            if(securities.at(config.contractID).getBook(BookSide::BidConsolidated)->size() >= 1)
-            {
-               config.histWindowLevel1VolumeBid->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getBook(BookSide::BidConsolidated)->at(0).volume);
-            }
-            if(securities.at(config.contractID).getBook(BookSide::AskConsolidated)->size() >= 1)
-            {
-               config.histWindowLevel1VolumeAsk->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getBook(BookSide::AskConsolidated)->at(0).volume);
-            }
-
-            bool saturated = false;
-            config.histWindowAPMBid->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getAPM(BookSide::BidConsolidated, config.dollarValue / metaData[config.contractID].PriceIncrease, saturated));
-            config.histWindowAPMAsk->SetBinContent(currentWindowNumber + 1, securities.at(config.contractID).getAPM(BookSide::AskConsolidated, config.dollarValue / metaData[config.contractID].PriceIncrease, saturated));
+   // Fill stage, and the server publishing the plots while they are filled
+   LOBFillStage fill;
+   fill.setup(configs, beginTime, endTime, snapshotSizes, snapshotRatios, skips, numberOfMessages, yBinMargin);
 
-            config.addSpreadMarkerWindow(static_cast<double>(currentWindowNumber * snapshotSize) / T_Second,
-               (securities.at(config.contractID).getMidPoint(Book::Consolidated) + 0.5) * metaData[config.contractID].PriceIncrease);
-         }
+   std::unique_ptr<LiveLOBServer> server;
+   if(!options.httpServer.empty())
+   {
+      server = std::make_unique<LiveLOBServer>(options.httpServer, options.replaySpeed, options.httpViewDirectory);
+      fill.serve(server.get());
+   }
 
-         for(auto& config : configs)
-         {
-            config.histWindowTime->SetBinContent(currentWindowNumber + 1, config.numberOfMessagesSinceLastSnapshot);
+   // Decompress the baskets of the input trees in parallel, ahead of the book stage. This is not a third
+   // stage: the windower still decodes the rows in the book stage thread.
+   std::unique_ptr<LOBParallelUnzipScope> parallelUnzip;
+   if(options.pipelined)
+   {
+      parallelUnzip = std::make_unique<LOBParallelUnzipScope>(options.pipelineThreads);
+   }
 
-            for(long i = snapshotStartMessage; i < currentMessageNumber; i++)
-            {
-               if(i % skip == 0)
-               {
-                  config.histMessageTrade->SetBinContent(1 + i / skip, config.tradeVolumeSinceLastSnapshot);
-                  config.histMessageTime->SetBinContent(1 + i / skip, config.numberOfMessagesSinceLastSnapshot);
-               }
-            }
+   // Book stage, in pipelined mode with the fill stage in its own thread
+   LOBBookStage bookStage;
+   bookStage.setup(configs, fill, snapshotRatios, skips, verticalLineTimes, options.pipelined);
 
-            config.tradeVolumeSinceLastSnapshot = 0;
-            config.numberOfMessagesSinceLastSnapshot = 0;
-         }
+   auto sampleSecurities = [&](const std::map<int, Security>& securities)
+   {
+      return [&](int i, const auto& use)
+      {
+         if(bookStage.contractStarted[i]) use(configs[i].book(securities.at(configs[i].contractID), cutMissing));
+         else use(bookStage.emptyBook);
+      };
+   };
 
-         currentWindowNumber++;
-         snapshotStartMessage = currentMessageNumber;
+   // Apply for each snapshot --> snapshot based plot
+   windower.setStateWindowAction(baseSnapshotSize, [&](TimeNS time, const std::map<int, Security>& securities)
+   {
+      if (beginTime <= time && time <= endTime)
+      {
+         bookStage.emitWindow(time, sampleSecurities(securities));
       }
    });
 
    // Apply for each row (each message) --> message based plot
    windower.setForEachRow([&](int id, TimeNS time, const MRow& row, const std::map<int, Security>& securities)
    {
+      const bool bookUpdate = row.messageKind >= (char)MessageKind::BidNew
+         && row.messageKind <= (char)MessageKind::AskDelete;
+      const bool trade = row.messageKind == static_cast<char>(MessageKind::Trade)
+         && row.quoteCondition == static_cast<char>(QuoteCondition::Trade);
+      if(bookUpdate || trade) bookStage.startContract(id);
+
       if (beginTime <= time && time <= endTime)
       {
-         if(verticalLineIndex < verticalLines.size())
-         {
-            if(verticalLines.at(verticalLineIndex).first - time <= 0)
-            {
-               verticalLinesMessage.push_back(currentMessageNumber);
-               verticalLineIndex++;
-            }
-         }
-         if(row.messageKind >= (char)MessageKind::BidNew
-            && row.messageKind <= (char)MessageKind::AskDelete)
+         bookStage.checkVerticalLines(time);
+
+         if(bookUpdate)
          {
-            for(auto& config : configs)
+            auto actions = securities.at(id).getLastUpdateActions();
+
+            bookStage.emitMessage(id, time, [&](const LOBPlotConfig& config, LOBEvent& event)
             {
-               auto actions = securities.at(id).getLastUpdateActions();
                for(auto a : *actions)
                {
-                  if(a.actionType == ActionType::DeleteAction)
-                  {
-                     if(a.side == Side::Bid)
-                     {
-                        if(a.price >= config.low && a.level == 1)
-                        {
-                           config.bidCancellations += a.volume;
-                        }
-                     }
-                     else
-                     {
-                        if(a.price <= config.high && a.level == 1)
-                        {
-                           config.askCancellations += a.volume;
-                        }
-                     }
-                  }
-               }
-
-               if(currentMessageNumber % skip == 0)
-               {
-                  auto FillLevel = [&](std::unique_ptr<TH2F>& hist, int id, BookSide side)
-                  {
-                     auto book = securities.at(id).getBook(side);
-                     for (auto &&level : *book)
-                     {
-                        if (level.price > 0)
-                        {
-                           hist->SetBinContent(1 + currentMessageNumber / skip,
-                              level.price - config.low + yBinMargin + 1,
-                              level.volume);
-                        }
-                     }
-                  };
-
-                  FillLevel(config.histMessageLob, config.contractID, BookSide::BidConsolidated);
-                  FillLevel(config.histMessageLob, config.contractID, BookSide::AskConsolidated);
-
-                  config.tradeVolumeSinceLastMessage = 0;
-                  config.histMessageCumulTrade->SetBinContent(1 + currentMessageNumber / skip, config.totalTradeVolume);
-                  config.histMessageCumulTradeBid->SetBinContent(1 + currentMessageNumber / skip, config.bidTradeVolume);
-                  config.histMessageCumulTradeAsk->SetBinContent(1 + currentMessageNumber / skip, config.askTradeVolume);
-                  config.histMessagePrice->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getPrice() * metaData[config.contractID].PriceIncrease);
-
-                  if(!cutMissing)
-                  {
-                     config.histMessageBidVolume->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getVolume(BookSide::BidConsolidated));
-                     config.histMessageAskVolume->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getVolume(BookSide::AskConsolidated));
-                  }
-                  else
-                  {
-                     config.histMessageBidVolume->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getVolume(BookSide::BidConsolidated, config.low));
-                     config.histMessageAskVolume->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getVolume(BookSide::AskConsolidated, config.high));
-                  }
-
-                  config.histMessageCancellationsBid->SetBinContent(1 + currentMessageNumber / skip, config.bidCancellations);
-                  config.histMessageCancellationsAsk->SetBinContent(1 + currentMessageNumber / skip, config.askCancellations);
-
-                  if(securities.at(config.contractID).getBook(BookSide::BidConsolidated)->size() >= 1)
-                  {
-                     config.histMessageLevel1VolumeBid->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getBook(BookSide::BidConsolidated)->at(0).volume);
-                  }
-                  if(securities.at(config.contractID).getBook(BookSide::AskConsolidated)->size() >= 1)
+                  if(a.actionType == ActionType::DeleteAction && a.level == 1)
                   {
-                     config.histMessageLevel1VolumeAsk->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getBook(BookSide::AskConsolidated)->at(0).volume);
+                     LOBBookStage::addCancellation(config, event, a.side == Side::Bid, a.price, a.volume);
                   }
-
-                  bool saturated = false;
-                  config.histMessageAPMBid->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getAPM(BookSide::BidConsolidated, config.dollarValue / metaData[config.contractID].PriceIncrease, saturated));
-                  config.histMessageAPMAsk->SetBinContent(1 + currentMessageNumber / skip, securities.at(config.contractID).getAPM(BookSide::AskConsolidated, config.dollarValue / metaData[config.contractID].PriceIncrease, saturated));
-
-                  config.addSpreadMarkerMessage(currentMessageNumber,
-                     (securities.at(config.contractID).getMidPoint(Book::Consolidated) + 0.5) * metaData[config.contractID].PriceIncrease);
-               }
-
-               if(id == config.contractID)
-               {
-                  config.numberOfMessagesSinceLastSnapshot++;
-                  config.numberOfMessagesSinceStart++;
                }
-            }
-
-            currentMessageNumber++;
-            if(currentMessageNumber % skip == 0)
-            {
-               histMessageCumulTime->SetBinContent(1 + currentMessageNumber / skip, double(time-beginTime) / T_Second);
-            }
-
-            if(configs.size() == 2)
-            {
-               //double ratio = (configs[0].numberOfMessagesSinceStart / (double)currentMessageNumber) - (configs[1].numberOfMessagesSinceStart / (double)currentMessageNumber);
-               double ratio = (configs[0].numberOfMessagesSinceStart / (double)configs[0].messages) - (configs[1].numberOfMessagesSinceStart / (double)configs[1].messages);
-               histMessageTimeRatio->SetBinContent(1 + currentMessageNumber / skip, ratio * 10.0 + 1);
-            }
+            }, sampleSecurities(securities));
          }
-         else if (row.messageKind == static_cast<char>(MessageKind::Trade)
-            && row.quoteCondition == static_cast<char>(QuoteCondition::Trade))
+         else if(trade)
          {
-            for(auto& config : configs)
-            {
-               if(id == config.contractID)
-               {
-                  config.totalTradeVolume += row.quantity;
-                  config.tradeVolumeSinceLastMessage += row.quantity;
-                  config.tradeVolumeSinceLastSnapshot += row.quantity;
-
-                  auto bidBook = securities.at(id).getBook(BookSide::BidConsolidated);
-                  auto askBook = securities.at(id).getBook(BookSide::AskConsolidated);
-
-                  if(bidBook->size() >= 1 && bidBook->at(0).price == row.price) // Short-circuit evaluation
-                  {
-                     config.bidTradeVolume += row.quantity;
-                  } 
-                  else if(askBook->size() >= 1 && askBook->at(0).price == row.price) // Short-circuit evaluation
-                  {
-                     config.askTradeVolume += row.quantity;
-                  }
-                  else
-                  {
-                     config.unexplainedTradeVolume += row.quantity;
-                  }
+            auto bidBook = securities.at(id).getBook(BookSide::BidConsolidated);
+            auto askBook = securities.at(id).getBook(BookSide::AskConsolidated);
 
-                  config.messageTrades.push_back(static_cast<double>(currentMessageNumber) / skip);
-                  config.windowTrades.push_back(currentWindowNumber + 1);
-               }
-            }
+            bookStage.emitTrade(id, time, row.quantity,
+               bidBook->size() >= 1 && bidBook->at(0).price == row.price, // Short-circuit evaluation
+               askBook->size() >= 1 && askBook->at(0).price == row.price);
          }
       }
    });
 
    // Build the plot
-   windower.run();
+   if(cache) bookStage.replay(*cache, cacheSlots, beginTime, endTime, baseSnapshotSize);
+   else windower.run();
+   bookStage.finish();
+
+   if(server)
+   {
+      server->finish(options.httpLinger);
+      server.reset();
+   }
 
    // Display some post building statistics
-   std::cout << "Window Plot: " << currentWindowNumber << " horizontal bins required. (" << numberOfBinsWindowHist << ")\n";
-   std::cout << "Message Plot: " << currentMessageNumber << " horizontal bins required. (" << numberOfMessages / skip << ")\n";
+   std::cout << "Window Plot: " << configs.front().windows.front().currentWindowNumber << " horizontal bins required. (" << numberOfBinsWindowHist << ")\n";
+   std::cout << "Message Plot: " << fill.currentMessageNumber << " horizontal bins required. (" << numberOfMessages / skip << ")\n";
 
    for(auto& config : configs)
    {
@@ -833,12 +2219,10 @@ void GenerateLiveLOBPlot(const std::string &rootPath,
       config.save(outputFile);
    }
 
-   outputFile.WriteObject(histMessageCumulTime.get(), histMessageCumulTime->GetName());
-   outputFile.WriteObject(histMessageTimeRatio.get(), histMessageTimeRatio->GetName());
+   fill.save(outputFile);
 
-   outputFile.WriteObject(&messagePlotSnapshotPoints, "messagePlotSnapshotPoints"); 
    outputFile.WriteObject(&verticalLinesWindow, "verticalLinesWindow");
-   outputFile.WriteObject(&verticalLinesMessage, "verticalLinesMessage");
+   outputFile.WriteObject(&bookStage.verticalLinesMessage, "verticalLinesMessage");
    outputFile.WriteObject(&verticalLinesTitle, "verticalLinesTitle");
 
    outputFile.Write();
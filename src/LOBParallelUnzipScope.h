@@ -0,0 +1,46 @@
+#pragma once
+
+#include <TROOT.h>
+#include <TTreeCacheUnzip.h>
+
+// Enables implicit multi-threading and the parallel decompression of the input trees while it exists, and restores
+// the previous global state of ROOT afterwards
+class LOBParallelUnzipScope
+{
+public:
+   // threads: size of the thread pool, 0 for all cores or to keep an already enabled pool
+   explicit LOBParallelUnzipScope(unsigned int threads)
+      : implicitMT(ROOT::IsImplicitMTEnabled()),
+      poolSize(ROOT::GetThreadPoolSize()),
+      parallelUnzip(TTreeCacheUnzip::IsParallelUnzip())
+   {
+      if(implicitMT && threads != 0 && threads != poolSize)
+      {
+         ROOT::DisableImplicitMT();
+      }
+      if(!ROOT::IsImplicitMTEnabled())
+      {
+         ROOT::EnableImplicitMT(threads);
+      }
+      TTreeCacheUnzip::SetParallelUnzip(TTreeCacheUnzip::kEnable);
+   }
+
+   LOBParallelUnzipScope(const LOBParallelUnzipScope&) = delete;
+   LOBParallelUnzipScope& operator=(const LOBParallelUnzipScope&) = delete;
+
+   ~LOBParallelUnzipScope()
+   {
+      TTreeCacheUnzip::SetParallelUnzip(parallelUnzip ? TTreeCacheUnzip::kEnable : TTreeCacheUnzip::kDisable);
+
+      if(!implicitMT || ROOT::GetThreadPoolSize() != poolSize)
+      {
+         ROOT::DisableImplicitMT();
+         if(implicitMT) ROOT::EnableImplicitMT(poolSize);
+      }
+   }
+
+private:
+   bool implicitMT;
+   unsigned int poolSize;
+   bool parallelUnzip;
+};
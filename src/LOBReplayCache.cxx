@@ -0,0 +1,386 @@
+#include "../../include/TimeNS.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Local cache of a replay: a file of fixed-width, time ordered records, memory mapped for reading.
+// The file consists of a header, the key it was written for, a table with one Slot per slot (e.g. the metadata of
+// a contract), the records (64 byte aligned), a table of entries and a time index. The entries hold the
+// variable-length parts of the records (e.g. the levels of a book), which refer to them by position. For every
+// second from the first record on, the index holds the position of the first record at or after that second,
+// followed by the position of the last record of each slot before it, or -1. This allows starting a replay anywhere without losing the state of slots which were updated
+// long before. Records, entries and slots must be trivially copyable, records have the members `TimeNS time` and
+// `int slot` (-1 for none).
+template <class Record, class Entry, class Slot>
+class LOBReplayCache
+{
+   // Version of the file layout, part of the magic
+   static constexpr char MAGIC[8] = {'L', 'O', 'B', 'C', 'A', 'C', 'H', '3'};
+
+   struct Header
+   {
+      char magic[8] = {};
+      std::uint32_t recordSize = 0;
+      std::uint32_t entrySize = 0;
+      std::uint32_t slots = 0;
+      std::uint32_t slotSize = 0;
+      std::uint64_t keySize = 0;
+      std::uint64_t slotsOffset = 0;
+      std::uint64_t recordsOffset = 0;
+      std::uint64_t numberOfRecords = 0;
+      std::uint64_t entriesOffset = 0;
+      std::uint64_t numberOfEntries = 0;
+      std::int64_t firstSecond = 0;
+      std::uint64_t indexOffset = 0;
+      std::uint64_t indexEntries = 0;
+   };
+
+public:
+   static_assert(std::is_trivially_copyable<Record>::value, "Cache records are stored as raw bytes");
+   static_assert(std::is_trivially_copyable<Entry>::value, "Cache entries are stored as raw bytes");
+   static_assert(std::is_trivially_copyable<Slot>::value, "Cache slots are stored as raw bytes");
+
+   LOBReplayCache() = default;
+   LOBReplayCache(const LOBReplayCache&) = delete;
+   LOBReplayCache& operator=(const LOBReplayCache&) = delete;
+
+   ~LOBReplayCache()
+   {
+      close();
+   }
+
+   // The file name of the cache of a key in a directory
+   static std::string path(const std::string& directory, const std::string& key)
+   {
+      std::ostringstream name;
+      name << directory << "/lobcache_" << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(key) << ".bin";
+      return name.str();
+   }
+
+   // Map a cache file, returns false if it does not exist or was written for another key or record layout
+   bool open(const std::string& fileName, const std::string& key)
+   {
+      close();
+
+      const int fd = ::open(fileName.c_str(), O_RDONLY);
+      if(fd < 0) return false;
+
+      struct stat info;
+      if(fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(Header)))
+      {
+         ::close(fd);
+         return false;
+      }
+
+      void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if(data == MAP_FAILED) return false;
+
+      mapped = static_cast<const char*>(data);
+      mappedSize = info.st_size;
+
+      const Header& header = *reinterpret_cast<const Header*>(mapped);
+      const bool valid = std::memcmp(header.magic, MAGIC, sizeof(header.magic)) == 0
+         && header.recordSize == sizeof(Record)
+         && header.entrySize == sizeof(Entry)
+         && header.slotSize == sizeof(Slot)
+         && header.slotsOffset == slotsOffset(header.keySize)
+         && header.recordsOffset == recordsOffset(header.keySize, header.slots)
+         && header.keySize == key.size()
+         && key.compare(0, key.size(), mapped + sizeof(Header), header.keySize) == 0
+         && header.entriesOffset == entriesOffset(header.recordsOffset, header.numberOfRecords)
+         && header.indexOffset == header.entriesOffset + header.numberOfEntries * sizeof(Entry)
+         && header.indexOffset + header.indexEntries * (1 + header.slots) * sizeof(std::int64_t) == mappedSize;
+
+      if(!valid)
+      {
+         close();
+         return false;
+      }
+
+      slotTable = reinterpret_cast<const Slot*>(mapped + header.slotsOffset);
+      records = reinterpret_cast<const Record*>(mapped + header.recordsOffset);
+      numberOfRecords = header.numberOfRecords;
+      entryTable = reinterpret_cast<const Entry*>(mapped + header.entriesOffset);
+      numberOfEntries = header.numberOfEntries;
+      index = reinterpret_cast<const std::int64_t*>(mapped + header.indexOffset);
+      indexEntries = header.indexEntries;
+      slots = header.slots;
+      firstSecond = header.firstSecond;
+
+      // Replays read the records front to back
+      madvise(data, mappedSize, MADV_SEQUENTIAL);
+
+      return true;
+   }
+
+   void close()
+   {
+      if(mapped) munmap(const_cast<char*>(mapped), mappedSize);
+
+      mapped = nullptr;
+      mappedSize = 0;
+      slotTable = nullptr;
+      records = nullptr;
+      numberOfRecords = 0;
+      entryTable = nullptr;
+      numberOfEntries = 0;
+      index = nullptr;
+      indexEntries = 0;
+   }
+
+   std::size_t size() const
+   {
+      return numberOfRecords;
+   }
+
+   int numberOfSlots() const
+   {
+      return slots;
+   }
+
+   // The data stored for a slot when the cache was written
+   const Slot& slot(int s) const
+   {
+      return slotTable[s];
+   }
+
+   const Record& at(std::size_t i) const
+   {
+      return records[i];
+   }
+
+   // The entries from a position returned by Writer::addEntries()
+   const Entry* entries(std::size_t position) const
+   {
+      return entryTable + position;
+   }
+
+   // Position of the first record at or after `time`, lastOfSlot is set to the position of the last record of each slot before it (or -1)
+   std::size_t seek(TimeNS time, std::vector<long long>& lastOfSlot) const
+   {
+      lastOfSlot.assign(slots, -1);
+      if(indexEntries == 0) return 0;
+
+      long long entry = time / T_Second - firstSecond;
+      if(entry < 0) return 0;
+      entry = std::min<long long>(entry, indexEntries - 1);
+
+      const std::int64_t* row = index + entry * (1 + slots);
+      std::size_t position = row[0];
+      for(int s = 0; s < slots; s++)
+      {
+         lastOfSlot[s] = row[1 + s];
+      }
+
+      for(; position < numberOfRecords && records[position].time < time; position++)
+      {
+         if(records[position].slot >= 0) lastOfSlot[records[position].slot] = position;
+      }
+
+      return position;
+   }
+
+   // Writes a cache file, records have to be added in time order. The file is written under a unique temporary name
+   // and only appears under its name once finished, so neither an interrupted build nor another process building
+   // the same cache at the same time can leave a mixed up file.
+   class Writer
+   {
+   public:
+      // slotData: the data stored for each slot, its size is the number of slots
+      Writer(const std::string& fileName, const std::string& key, const std::vector<Slot>& slotData)
+         : fileName(fileName), lastOfSlot(slotData.size(), -1)
+      {
+         temporaryFileName = createTemporaryFile(fileName);
+         file.open(temporaryFileName, std::ios::binary | std::ios::trunc);
+         if(!file) throw std::runtime_error("Could not create " + temporaryFileName);
+
+         // The entries are collected separately and appended to the records at the end
+         entriesFileName = createTemporaryFile(fileName + ".entries");
+         entriesFile.open(entriesFileName, std::ios::binary | std::ios::trunc);
+         if(!entriesFile) throw std::runtime_error("Could not create " + entriesFileName);
+
+         std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+         header.recordSize = sizeof(Record);
+         header.entrySize = sizeof(Entry);
+         header.slots = slotData.size();
+         header.slotSize = sizeof(Slot);
+         header.keySize = key.size();
+         header.slotsOffset = slotsOffset(key.size());
+         header.recordsOffset = recordsOffset(key.size(), slotData.size());
+
+         // The header is written again by finish()
+         file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+         file.write(key.data(), key.size());
+         const std::vector<char> padding(64, 0);
+         file.write(padding.data(), header.slotsOffset - sizeof(Header) - key.size());
+         file.write(reinterpret_cast<const char*>(slotData.data()), slotData.size() * sizeof(Slot));
+         file.write(padding.data(), header.recordsOffset - header.slotsOffset - slotData.size() * sizeof(Slot));
+      }
+
+      Writer(const Writer&) = delete;
+      Writer& operator=(const Writer&) = delete;
+
+      ~Writer()
+      {
+         entriesFile.close();
+         if(!entriesFileName.empty()) std::remove(entriesFileName.c_str());
+
+         if(!finished)
+         {
+            file.close();
+            if(!temporaryFileName.empty()) std::remove(temporaryFileName.c_str());
+         }
+      }
+
+      // Add entries referred to by the following record, returns the position of the first one
+      std::size_t addEntries(const Entry* entries, std::size_t count)
+      {
+         entriesFile.write(reinterpret_cast<const char*>(entries), count * sizeof(Entry));
+
+         const std::size_t position = header.numberOfEntries;
+         header.numberOfEntries += count;
+         return position;
+      }
+
+      void add(const Record& record)
+      {
+         const long long second = record.time / T_Second;
+         if(header.numberOfRecords == 0)
+         {
+            header.firstSecond = second;
+         }
+         else if(record.time < lastTime)
+         {
+            throw std::runtime_error("Cache records are not time ordered");
+         }
+
+         while(header.firstSecond + static_cast<long long>(header.indexEntries) <= second)
+         {
+            addIndexEntry();
+         }
+
+         file.write(reinterpret_cast<const char*>(&record), sizeof(Record));
+
+         if(record.slot >= 0) lastOfSlot[record.slot] = header.numberOfRecords;
+         header.numberOfRecords++;
+         lastTime = record.time;
+      }
+
+      void finish()
+      {
+         // One more entry after the last record, so seeking beyond the end does not scan the last second
+         if(header.numberOfRecords > 0) addIndexEntry();
+
+         header.entriesOffset = entriesOffset(header.recordsOffset, header.numberOfRecords);
+         const std::vector<char> padding(header.entriesOffset - header.recordsOffset - header.numberOfRecords * sizeof(Record), 0);
+         file.write(padding.data(), padding.size());
+
+         entriesFile.close();
+         if(!entriesFile) throw std::runtime_error("Could not write " + entriesFileName);
+         if(header.numberOfEntries > 0)
+         {
+            std::ifstream entries(entriesFileName, std::ios::binary);
+            file << entries.rdbuf();
+         }
+         std::remove(entriesFileName.c_str());
+         entriesFileName.clear();
+
+         header.indexOffset = header.entriesOffset + header.numberOfEntries * sizeof(Entry);
+         file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(std::int64_t));
+
+         file.seekp(0);
+         file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+         file.close();
+         if(!file) throw std::runtime_error("Could not write " + temporaryFileName);
+
+         if(std::rename(temporaryFileName.c_str(), fileName.c_str()) != 0)
+         {
+            throw std::runtime_error("Could not rename " + temporaryFileName + " to " + fileName);
+         }
+         finished = true;
+      }
+
+   private:
+      // Create a new file next to `name`, readable like a regular file, and return its name
+      static std::string createTemporaryFile(const std::string& name)
+      {
+         std::vector<char> pattern(name.begin(), name.end());
+         const std::string suffix = ".XXXXXX";
+         pattern.insert(pattern.end(), suffix.begin(), suffix.end());
+         pattern.push_back('\0');
+
+         const int fd = mkstemp(pattern.data());
+         if(fd < 0) throw std::runtime_error("Could not create a temporary file for " + name);
+         fchmod(fd, 0644);
+         ::close(fd);
+         return pattern.data();
+      }
+
+      void addIndexEntry()
+      {
+         index.push_back(header.numberOfRecords);
+         index.insert(index.end(), lastOfSlot.begin(), lastOfSlot.end());
+         header.indexEntries++;
+      }
+
+      std::string fileName;
+      std::string temporaryFileName;
+      std::string entriesFileName;
+      std::ofstream file;
+      std::ofstream entriesFile;
+      Header header;
+      std::vector<std::int64_t> index;
+      std::vector<std::int64_t> lastOfSlot;
+      TimeNS lastTime = 0;
+      bool finished = false;
+   };
+
+private:
+   // The slots follow the key, 8 byte aligned
+   static std::uint64_t slotsOffset(std::uint64_t keySize)
+   {
+      return (sizeof(Header) + keySize + 7) / 8 * 8;
+   }
+
+   // The records start on a 64 byte boundary after the slots
+   static std::uint64_t recordsOffset(std::uint64_t keySize, std::uint64_t numberOfSlots)
+   {
+      return (slotsOffset(keySize) + numberOfSlots * sizeof(Slot) + 63) / 64 * 64;
+   }
+
+   // The entries start on a 64 byte boundary after the records
+   static std::uint64_t entriesOffset(std::uint64_t recordsOffset, std::uint64_t numberOfRecords)
+   {
+      return (recordsOffset + numberOfRecords * sizeof(Record) + 63) / 64 * 64;
+   }
+
+   const char* mapped = nullptr;
+   std::size_t mappedSize = 0;
+
+   const Slot* slotTable = nullptr;
+   const Record* records = nullptr;
+   std::size_t numberOfRecords = 0;
+   const Entry* entryTable = nullptr;
+   std::size_t numberOfEntries = 0;
+   const std::int64_t* index = nullptr;
+   std::size_t indexEntries = 0;
+   int slots = 0;
+   long long firstSecond = 0;
+};
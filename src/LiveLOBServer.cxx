@@ -0,0 +1,303 @@
+#include "../../include/TimeNS.h"
+
+#include <THttpServer.h>
+#include <THttpCallArg.h>
+#include <TH2.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// HTTP server publishing the plots of GenerateLiveLOBPlot while they are being filled.
+// The histograms can be browsed with JSROOT at the root of the server, the page lobview/LiveLOB.htm
+// shows the live LOB plots. Both use incremental updates from
+//    lobdelta.json?config=1&axis=window&since=10
+// which returns the LOB columns, spread marker points and trades (in bins) added after sequence number `since`,
+// the sequence number being the number of completed histogram columns. The spread marker is returned as a step
+// function, the spread marker graph itself is only created when the plots are saved.
+// The timer of THttpServer is disabled, so requests are queued by the server threads and only answered inside
+// ProcessRequests(), which is called from the thread filling the histograms through pace() (the fill thread
+// in pipelined mode), so the histograms are never read while being filled.
+// After the replay finish() keeps answering requests until the clients fetched the last columns.
+class LiveLOBServer : public THttpServer
+{
+public:
+   // Maximum number of columns per response, clients keep polling until they reach the latest sequence
+   static constexpr long MAXCOLUMNS = 5000;
+
+   // engine: THttpServer engine, e.g. "http:8080"
+   // replaySpeed: replay speed relative to the message time stamps, 0 to replay as fast as possible
+   // viewDirectory: directory containing LiveLOB.htm, empty for the directory of this source file
+   LiveLOBServer(const std::string& engine, double replaySpeed, const std::string& viewDirectory = "")
+      : THttpServer(engine.c_str()), replaySpeed(replaySpeed)
+   {
+      // No timer answering requests from gSystem->ProcessEvents(), which could run while the histograms are filled
+      SetTimer(0);
+
+      std::string directory = viewDirectory;
+      if(directory.empty())
+      {
+         const std::string sourceFile = __FILE__;
+         const auto slash = sourceFile.find_last_of('/');
+         directory = slash == std::string::npos ? "." : sourceFile.substr(0, slash);
+      }
+      if(directory.back() != '/') directory += "/";
+
+      if(!std::ifstream(directory + "LiveLOB.htm"))
+      {
+         throw std::invalid_argument("LiveLOB.htm not found in " + directory + ", set the directory of the live view (httpViewDirectory)");
+      }
+      AddLocation("lobview/", directory.c_str());
+
+      std::cout << "Live LOB view at " << engine << "/lobview/LiveLOB.htm\n";
+   }
+
+   ~LiveLOBServer()
+   {
+      for(auto& s : series)
+      {
+         Unregister(s.lob);
+      }
+   }
+
+   // Register the series of one plot axis ("window" or "message") of a configuration, returns the handle for publish().
+   // spreadX and spreadY hold the points where the mid point changes. The trades are stored as positions which are
+   // rounded down and shifted by tradeBinOffset to get the (1-based) histogram bin.
+   int addSeries(int config, const std::string& axis, TH2* lob, const std::vector<double>* spreadX, const std::vector<double>* spreadY, const std::vector<double>* trades, int tradeBinOffset, double maxVolume)
+   {
+      Register(("/LOB/" + axis).c_str(), lob);
+
+      series.emplace_back();
+      series.back().config = config;
+      series.back().axis = axis;
+      series.back().lob = lob;
+      series.back().spreadX = spreadX;
+      series.back().spreadY = spreadY;
+      series.back().trades = trades;
+      series.back().tradeBinOffset = tradeBinOffset;
+      series.back().maxVolume = maxVolume;
+
+      // One entry per column, so publishing does not allocate
+      series.back().spreadPoints.reserve(lob->GetNbinsX() + 2);
+      series.back().tradeCount.reserve(lob->GetNbinsX() + 2);
+      series.back().spreadPoints.push_back(0);
+      series.back().tradeCount.push_back(0);
+
+      return series.size() - 1;
+   }
+
+   // Mark the histogram columns up to and including `sequence` as complete
+   void publish(int handle, long sequence)
+   {
+      auto& s = series[handle];
+      while(static_cast<long>(s.spreadPoints.size()) <= sequence)
+      {
+         s.spreadPoints.push_back(s.spreadX->size());
+         s.tradeCount.push_back(s.trades->size());
+      }
+   }
+
+   // Answer the queued requests and, if a replay speed is set, wait until `time` is due
+   void pace(TimeNS time)
+   {
+      auto now = std::chrono::steady_clock::now();
+
+      if(replaySpeed > 0)
+      {
+         if(firstTime < 0)
+         {
+            firstTime = time;
+            wallStart = now;
+         }
+
+         const auto due = wallStart + std::chrono::nanoseconds(static_cast<long long>((time - firstTime) / replaySpeed));
+         while(now < due)
+         {
+            ProcessRequests();
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(due - now, std::chrono::milliseconds(10)));
+            now = std::chrono::steady_clock::now();
+         }
+      }
+
+      if(now >= nextRequests)
+      {
+         ProcessRequests();
+         nextRequests = now + std::chrono::milliseconds(10);
+      }
+   }
+
+   // Called after the replay: keep answering requests until every requested series has been fetched up to its
+   // last column, or for at most `linger` seconds. Without any client the server waits the full time.
+   void finish(double linger)
+   {
+      finished = true;
+      if(linger <= 0) return;
+
+      std::cout << "Serving the final plots for up to " << linger << " s\n";
+
+      const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<long long>(linger * 1000));
+      while(std::chrono::steady_clock::now() < deadline)
+      {
+         ProcessRequests();
+
+         bool requested = false;
+         bool delivered = true;
+         for(auto& s : series)
+         {
+            requested = requested || s.requested;
+            delivered = delivered && (!s.requested || s.delivered);
+         }
+         if(requested && delivered) break;
+
+         std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+   }
+
+protected:
+   void ProcessRequest(std::shared_ptr<THttpCallArg> arg) override
+   {
+      if(std::string(arg->GetFileName()) != "lobdelta.json")
+      {
+         THttpServer::ProcessRequest(arg);
+         return;
+      }
+
+      int config = 1;
+      std::string axis = "window";
+      long since = 0;
+
+      std::istringstream query(arg->GetQuery());
+      std::string parameter;
+      while(std::getline(query, parameter, '&'))
+      {
+         const auto separator = parameter.find('=');
+         if(separator == std::string::npos) continue;
+
+         const std::string key = parameter.substr(0, separator);
+         const std::string value = parameter.substr(separator + 1);
+         try
+         {
+            if(key == "config") config = std::stoi(value);
+            else if(key == "axis") axis = value;
+            else if(key == "since") since = std::stol(value);
+         }
+         catch(const std::exception&)
+         {
+            arg->Set404();
+            return;
+         }
+      }
+
+      for(auto& s : series)
+      {
+         if(s.config == config && s.axis == axis)
+         {
+            arg->SetJsonContent(deltaJson(s, since));
+            return;
+         }
+      }
+
+      arg->Set404();
+   }
+
+private:
+   struct Series
+   {
+      int config = 0;
+      std::string axis;
+      TH2* lob = nullptr;
+      const std::vector<double>* spreadX = nullptr;
+      const std::vector<double>* spreadY = nullptr;
+      const std::vector<double>* trades = nullptr;
+      int tradeBinOffset = 0;
+      double maxVolume = 0;
+
+      // The series was requested at least once, and up to its last column after the replay
+      bool requested = false;
+      bool delivered = false;
+
+      // Number of spread marker points and trades at the completion of each sequence number
+      std::vector<long> spreadPoints;
+      std::vector<long> tradeCount;
+   };
+
+   std::string deltaJson(Series& s, long since)
+   {
+      const long published = static_cast<long>(s.spreadPoints.size()) - 1;
+      since = std::max(0L, std::min(since, published));
+      const long sequence = std::min(published, since + MAXCOLUMNS);
+
+      s.requested = true;
+      s.delivered = s.delivered || (finished && sequence == published);
+
+      std::ostringstream json;
+      json << std::setprecision(12);
+      json << "{\"config\":" << s.config << ",\"axis\":\"" << s.axis << "\""
+         << ",\"sequence\":" << sequence << ",\"published\":" << std::max(0L, published)
+         << ",\"finished\":" << (finished ? "true" : "false")
+         << ",\"maxVolume\":" << s.maxVolume
+         << ",\"x\":{\"bins\":" << s.lob->GetNbinsX() << ",\"min\":" << s.lob->GetXaxis()->GetXmin() << ",\"max\":" << s.lob->GetXaxis()->GetXmax() << "}"
+         << ",\"y\":{\"bins\":" << s.lob->GetNbinsY() << ",\"min\":" << s.lob->GetYaxis()->GetXmin() << ",\"max\":" << s.lob->GetYaxis()->GetXmax() << "}";
+
+      // Only the non-empty levels of the new columns, as [y bin, volume] pairs
+      json << ",\"columns\":[";
+      for(long x = since + 1; x <= sequence; x++)
+      {
+         json << (x == since + 1 ? "" : ",") << "{\"bin\":" << x << ",\"levels\":[";
+         bool first = true;
+         for(int y = 1; y <= s.lob->GetNbinsY(); y++)
+         {
+            const double volume = s.lob->GetBinContent(x, y);
+            if(volume != 0)
+            {
+               json << (first ? "" : ",") << "[" << y << "," << volume << "]";
+               first = false;
+            }
+         }
+         json << "]}";
+      }
+      json << "]";
+
+      // The step function: the previous mid point up to each change, then the new one
+      json << ",\"spread\":[";
+      if(sequence > since)
+      {
+         for(long i = s.spreadPoints[since]; i < s.spreadPoints[sequence]; i++)
+         {
+            json << (i == s.spreadPoints[since] ? "" : ",");
+            if(i > 0) json << "[" << s.spreadX->at(i) << "," << s.spreadY->at(i - 1) << "],";
+            json << "[" << s.spreadX->at(i) << "," << s.spreadY->at(i) << "]";
+         }
+      }
+      json << "]";
+
+      json << ",\"trades\":[";
+      if(sequence > since)
+      {
+         for(long i = s.tradeCount[since]; i < s.tradeCount[sequence]; i++)
+         {
+            json << (i == s.tradeCount[since] ? "" : ",") << static_cast<long>(std::floor(s.trades->at(i))) + s.tradeBinOffset;
+         }
+      }
+      json << "]}";
+
+      return json.str();
+   }
+
+   std::vector<Series> series;
+
+   double replaySpeed = 0;
+   bool finished = false;
+   TimeNS firstTime = -1;
+   std::chrono::steady_clock::time_point wallStart;
+   std::chrono::steady_clock::time_point nextRequests;
+};
@@ -0,0 +1,380 @@
+// Standalone driver for GenerateLiveLOBPlot and drawLOB, reading all parameters from a job file.
+//
+// Compiled, the generation and rendering run natively without the interpreter (see CMakeLists.txt for the options):
+//    cmake -S . -B build -DHIGHLO_INCLUDE_DIR=... && cmake --build build
+//    ./build/RunLOBJob LiveLOB.job
+// From a notebook the same entry point can be used after including this file:
+//    RunLOBJob("LiveLOB.job");
+//
+// A job file consists of "key = value" lines, where the keys are the names of the corresponding
+// parameters or struct members. Lines starting with '#' are comments, note that ROOT's latex
+// commands (e.g. #splitline) can still be used inside values. The keys before the first section
+// hold the arguments and options of GenerateLiveLOBPlot, followed by the repeatable sections:
+//    [config]  one LOBPlotConfig
+//    [line]    one vertical line (time, title)
+//    [draw]    one output image, containing the GeneralData members and input/output file names, or an
+//              animation if frames is set (see LOBAnimation::renderFrames for the output names)
+//    [plot]    one PlotData, belonging to the last [draw] section
+// Times are given as timestamps (e.g. 20151112150000000), durations in ns or with a ms, s or min suffix.
+// Lists (extraSnapshotSizes, extraSkips) are comma separated.
+// With scanBurst = n, the period from beginTime to endTime is first scanned with ScanLOBActivity (configured by the
+// scan... keys, e.g. scanWindowLength = 10min), and the plot is made of the n-th most active window instead. The windows
+// start on multiples of scanStep, which defaults to the least common multiple of the snapshot sizes (and one second).
+// Without [config] sections only the drawing is done, without [draw] sections only the generation.
+
+#include "GenerateLiveLOBPlot.cxx"
+#include "ScanLOBActivity.cxx"
+#include "drawLOB.C"
+
+#include <TROOT.h>
+
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+// Struct to contain the parameters of a single drawLOB call
+struct LOBJobDrawing
+{
+   std::string fileNameIn;
+   std::string fileNameOut;
+   GeneralData generalData;
+   std::vector<PlotData> plotData;
+
+   // Animation of a sliding x range, only if frames > 0
+   int frames = 0;
+   double frameBegin = 0;
+   double frameWidth = 0;
+   double frameStep = 0;
+};
+
+// Struct to contain all parameters of a job, as read from the job file
+struct LOBJob
+{
+   std::string rootPath;
+   std::string outputFileName;
+   TimeNS beginTime = 0;
+   TimeNS endTime = 0;
+   std::string title;
+   TimeNS snapshotSize = T_Second;
+   bool cutMissing = false;
+   LOBGeneratorOptions options;
+
+   // Rank of the scanned window to plot, 0 to plot from beginTime to endTime
+   int scanBurst = 0;
+   LOBScanOptions scan;
+   // Step of the scanned windows, 0 for the least common multiple of the snapshot sizes and one second
+   TimeNS scanStep = 0;
+
+   std::vector<LOBPlotConfig> configs;
+   std::vector<std::pair<TimeNS, std::string>> verticalLines;
+   std::vector<LOBJobDrawing> drawings;
+};
+
+std::string trimJobString(const std::string& s)
+{
+   const auto begin = s.find_first_not_of(" \t\r");
+   if(begin == std::string::npos) return "";
+   const auto end = s.find_last_not_of(" \t\r");
+   return s.substr(begin, end - begin + 1);
+}
+
+bool parseJobBool(const std::string& value)
+{
+   if(value == "true" || value == "1" || value == "yes") return true;
+   if(value == "false" || value == "0" || value == "no") return false;
+   throw std::invalid_argument("Not a boolean: " + value);
+}
+
+// Parse a non-negative count, e.g. a number of threads
+unsigned int parseJobCount(const std::string& value)
+{
+   const int number = std::stoi(value);
+   if(number < 0) throw std::invalid_argument("Not a non-negative number: " + value);
+   return static_cast<unsigned int>(number);
+}
+
+// Parse a duration in nanoseconds, or with a ms, s or min suffix
+TimeNS parseJobDuration(const std::string& value)
+{
+   std::size_t end = 0;
+   const double number = std::stod(value, &end);
+   const std::string unit = trimJobString(value.substr(end));
+
+   if(unit == "" || unit == "ns") return static_cast<TimeNS>(number);
+   if(unit == "ms") return static_cast<TimeNS>(number * T_Milis);
+   if(unit == "s") return static_cast<TimeNS>(number * T_Second);
+   if(unit == "min") return static_cast<TimeNS>(number * 60 * T_Second);
+   throw std::invalid_argument("Unknown time unit: " + value);
+}
+
+// Parse a comma separated list of values
+template <class T, class Parser>
+std::vector<T> parseJobList(const std::string& value, Parser parse)
+{
+   std::vector<T> list;
+   std::size_t begin = 0;
+   while(begin <= value.size())
+   {
+      auto end = value.find(',', begin);
+      if(end == std::string::npos) end = value.size();
+
+      const std::string element = trimJobString(value.substr(begin, end - begin));
+      if(!element.empty()) list.push_back(parse(element));
+      begin = end + 1;
+   }
+   return list;
+}
+
+// Assign a single key of the job file, returns false if the key is unknown for the section
+bool setJobValue(LOBJob& job, const std::string& section, const std::string& key, const std::string& value)
+{
+   if(section == "")
+   {
+      if(key == "rootPath") job.rootPath = value;
+      else if(key == "outputFileName") job.outputFileName = value;
+      else if(key == "beginTime") job.beginTime = timestampToNS(value);
+      else if(key == "endTime") job.endTime = timestampToNS(value);
+      else if(key == "title") job.title = value;
+      else if(key == "snapshotSize") job.snapshotSize = parseJobDuration(value);
+      else if(key == "cutMissing") job.cutMissing = parseJobBool(value);
+      else if(key == "httpServer") job.options.httpServer = value;
+      else if(key == "replaySpeed") job.options.replaySpeed = std::stod(value);
+      else if(key == "httpLinger") job.options.httpLinger = std::stod(value);
+      else if(key == "httpViewDirectory") job.options.httpViewDirectory = value;
+      else if(key == "pipelined") job.options.pipelined = parseJobBool(value);
+      else if(key == "pipelineThreads") job.options.pipelineThreads = parseJobCount(value);
+      else if(key == "cacheDirectory") job.options.cacheDirectory = value;
+      else if(key == "extraSnapshotSizes") job.options.extraSnapshotSizes = parseJobList<TimeNS>(value, parseJobDuration);
+      else if(key == "scanBurst") job.scanBurst = std::stoi(value);
+      else if(key == "scanWindowLength") job.scan.windowLength = parseJobDuration(value);
+      else if(key == "scanStep") job.scanStep = parseJobDuration(value);
+      else if(key == "scanThreads") job.scan.threads = parseJobCount(value);
+      else if(key == "scanMessageWeight") job.scan.messageWeight = std::stod(value);
+      else if(key == "scanTradeWeight") job.scan.tradeWeight = std::stod(value);
+      else if(key == "scanCancellationWeight") job.scan.cancellationWeight = std::stod(value);
+      else if(key == "scanSpreadWeight") job.scan.spreadWeight = std::stod(value);
+      else if(key == "extraSkips") job.options.extraSkips = parseJobList<int>(value, [](const std::string& v) { return std::stoi(v); });
+      else return false;
+   }
+   else if(section == "config")
+   {
+      auto& config = job.configs.back();
+      if(key == "fileName") config.fileName = value;
+      else if(key == "contract") config.contract = value;
+      else if(key == "yAxisTitle") config.yAxisTitle = value;
+      else if(key == "dollarValue") config.dollarValue = std::stod(value);
+      else return false;
+   }
+   else if(section == "line")
+   {
+      auto& line = job.verticalLines.back();
+      if(key == "time") line.first = timestampToNS(value);
+      else if(key == "title") line.second = value;
+      else return false;
+   }
+   else if(section == "draw")
+   {
+      auto& drawing = job.drawings.back();
+      if(key == "input") drawing.fileNameIn = value;
+      else if(key == "output") drawing.fileNameOut = value;
+      else if(key == "type") drawing.generalData.type = value;
+      else if(key == "xAxisTitle") drawing.generalData.xAxisTitle = value;
+      else if(key == "drawEventLines") drawing.generalData.drawEventLines = parseJobBool(value);
+      else if(key == "dataEventLines") drawing.generalData.dataEventLines = value;
+      else if(key == "frames") drawing.frames = std::stoi(value);
+      else if(key == "frameBegin") drawing.frameBegin = std::stod(value);
+      else if(key == "frameWidth") drawing.frameWidth = std::stod(value);
+      else if(key == "frameStep") drawing.frameStep = std::stod(value);
+      else return false;
+   }
+   else if(section == "plot")
+   {
+      auto& plot = job.drawings.back().plotData.back();
+      if(key == "height") plot.height = std::stof(value);
+      else if(key == "legendLocation") plot.legendLocation = value;
+      else if(key == "dataLeft") plot.dataLeft = value;
+      else if(key == "legendLeft") plot.legendLeft = value;
+      else if(key == "isLOB") plot.isLOB = parseJobBool(value);
+      else if(key == "dataSpreadMaker") plot.dataSpreadMaker = value;
+      else if(key == "drawDots") plot.drawDots = parseJobBool(value);
+      else if(key == "dataDots") plot.dataDots = value;
+      else if(key == "legendDots") plot.legendDots = value;
+      else if(key == "legendEventLines") plot.legendEventLines = value;
+      else if(key == "overlay") plot.overlay = parseJobBool(value);
+      else if(key == "dataRight") plot.dataRight = value;
+      else if(key == "titleRight") plot.titleRight = value;
+      else if(key == "addSnapshotPoints") plot.addSnapshotPoints = parseJobBool(value);
+      else if(key == "dataSnapshotPoints") plot.dataSnapshotPoints = value;
+      else if(key == "legendSnapshotPoints") plot.legendSnapshotPoints = value;
+      else if(key == "yAxisTitle") plot.yAxisTitle = value;
+      else if(key == "forceYAxis") plot.forceYAxis = parseJobBool(value);
+      else if(key == "tickSize") plot.tickSize = std::stof(value);
+      else if(key == "padding") plot.padding = std::stoi(value);
+      else return false;
+   }
+   else
+   {
+      return false;
+   }
+
+   return true;
+}
+
+// Read a job file, as described at the top of this file
+LOBJob ReadLOBJob(const std::string& jobFileName)
+{
+   std::ifstream jobFile(jobFileName);
+   if(!jobFile) throw std::invalid_argument("Could not open " + jobFileName);
+
+   LOBJob job;
+   std::string section;
+   std::string line;
+   int lineNumber = 0;
+
+   while(std::getline(jobFile, line))
+   {
+      lineNumber++;
+      const std::string location = jobFileName + ":" + std::to_string(lineNumber) + ": ";
+
+      line = trimJobString(line);
+      if(line.empty() || line[0] == '#') continue;
+
+      if(line.front() == '[' && line.back() == ']')
+      {
+         section = trimJobString(line.substr(1, line.size() - 2));
+
+         if(section == "config") job.configs.emplace_back();
+         else if(section == "line") job.verticalLines.emplace_back(0, "");
+         else if(section == "draw") job.drawings.emplace_back();
+         else if(section == "plot" && !job.drawings.empty()) job.drawings.back().plotData.emplace_back(1.0, "");
+         else if(section == "plot") throw std::runtime_error(location + "[plot] without preceding [draw]");
+         else throw std::runtime_error(location + "unknown section [" + section + "]");
+
+         continue;
+      }
+
+      const auto separator = line.find('=');
+      if(separator == std::string::npos) throw std::runtime_error(location + "expected key = value");
+
+      const std::string key = trimJobString(line.substr(0, separator));
+      const std::string value = trimJobString(line.substr(separator + 1));
+
+      try
+      {
+         if(!setJobValue(job, section, key, value)) throw std::runtime_error("unknown key " + key);
+      }
+      catch(const std::exception& e)
+      {
+         throw std::runtime_error(location + e.what());
+      }
+   }
+
+   for(auto& drawing : job.drawings)
+   {
+      if(drawing.fileNameIn.empty()) drawing.fileNameIn = job.outputFileName;
+   }
+
+   return job;
+}
+
+// Main function to run a job: generate the plot data and draw all images
+void RunLOBJob(LOBJob& job)
+{
+   if(job.scanBurst > 0 && !job.configs.empty())
+   {
+      std::vector<std::pair<std::string, std::string>> inputs;
+      for(auto& config : job.configs)
+      {
+         inputs.emplace_back(config.fileName, config.contract);
+      }
+
+      // The scanned windows have to start on a snapshot of every snapshot size (and on a whole second)
+      TimeNS snapshotMultiple = T_Second;
+      std::vector<TimeNS> snapshotSizes = job.options.extraSnapshotSizes;
+      snapshotSizes.push_back(job.snapshotSize);
+      for(auto size : snapshotSizes)
+      {
+         if(size <= 0) throw std::invalid_argument("Snapshot size must be positive");
+         snapshotMultiple = std::lcm(snapshotMultiple, size);
+      }
+
+      if(job.scanStep == 0)
+      {
+         job.scan.step = snapshotMultiple;
+      }
+      else
+      {
+         for(auto size : snapshotSizes)
+         {
+            if(job.scanStep % size != 0) throw std::invalid_argument("scanStep must be a multiple of every snapshot size");
+         }
+         job.scan.step = job.scanStep;
+      }
+
+      job.scan.topK = std::max(job.scan.topK, job.scanBurst);
+      const auto bursts = ScanLOBActivity(job.rootPath, inputs, job.beginTime, job.endTime, job.scan);
+      if(bursts.size() < static_cast<std::size_t>(job.scanBurst)) throw std::runtime_error("Found only " + std::to_string(bursts.size()) + " windows");
+
+      const auto& burst = bursts[job.scanBurst - 1];
+      job.beginTime = burst.beginTime;
+      job.endTime = burst.endTime;
+      job.verticalLines.insert(job.verticalLines.end(), burst.verticalLines.begin(), burst.verticalLines.end());
+      std::sort(job.verticalLines.begin(), job.verticalLines.end());
+   }
+
+   if(!job.configs.empty())
+   {
+      GenerateLiveLOBPlot(job.rootPath, job.outputFileName, job.beginTime, job.endTime, job.title, job.snapshotSize, job.configs, job.verticalLines, job.cutMissing, job.options);
+   }
+
+   for(const auto& drawing : job.drawings)
+   {
+      if(drawing.frames > 0)
+      {
+         LOBAnimation animation(drawing.fileNameIn, drawing.generalData, drawing.plotData);
+         animation.renderFrames(drawing.frameBegin, drawing.frameWidth, drawing.frameStep, drawing.frames, drawing.fileNameOut);
+      }
+      else
+      {
+         drawLOB(drawing.fileNameIn, drawing.fileNameOut, drawing.generalData, drawing.plotData);
+      }
+   }
+}
+
+void RunLOBJob(const std::string& jobFileName)
+{
+   auto job = ReadLOBJob(jobFileName);
+   RunLOBJob(job);
+}
+
+#if !defined(__CLING__)
+int main(int argc, char** argv)
+{
+   if(argc < 2)
+   {
+      std::cerr << "Usage: " << argv[0] << " <job file> [<job file> ...]\n";
+      return 1;
+   }
+
+   gROOT->SetBatch(kTRUE);
+
+   try
+   {
+      for(int i = 1; i < argc; i++)
+      {
+         std::cout << "Running job " << argv[i] << "\n";
+         RunLOBJob(std::string(argv[i]));
+      }
+   }
+   catch(const std::exception& e)
+   {
+      std::cerr << "Error: " << e.what() << "\n";
+      return 1;
+   }
+
+   return 0;
+}
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue between exactly one producer and one consumer thread.
+// The elements are preallocated and reused: the producer fills back() and publishes it with push(),
+// the consumer reads front() and releases it with pop(). back() waits while the queue is full, which
+// throttles the producer to the speed of the consumer, front() waits while the queue is empty.
+template <class T>
+class SPSCQueue
+{
+public:
+   // The capacity is rounded up to a power of two, all elements start as copies of the prototype
+   explicit SPSCQueue(std::size_t capacity, const T& prototype = T())
+   {
+      std::size_t size = 1;
+      while(size < capacity) size *= 2;
+
+      buffer.assign(size, prototype);
+      mask = size - 1;
+   }
+
+   SPSCQueue(const SPSCQueue&) = delete;
+   SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+   // Producer: the next free element, waits until one is available
+   T& back()
+   {
+      const std::size_t h = head.load(std::memory_order_relaxed);
+      int spins = 0;
+      while(h - cachedTail > mask)
+      {
+         cachedTail = tail.load(std::memory_order_acquire);
+         if(h - cachedTail > mask) wait(spins);
+      }
+      return buffer[h & mask];
+   }
+
+   // Producer: publish the element returned by back()
+   void push()
+   {
+      head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   }
+
+   // Consumer: the oldest published element, waits until one is available
+   T& front()
+   {
+      const std::size_t t = tail.load(std::memory_order_relaxed);
+      int spins = 0;
+      while(t == cachedHead)
+      {
+         cachedHead = head.load(std::memory_order_acquire);
+         if(t == cachedHead) wait(spins);
+      }
+      return buffer[t & mask];
+   }
+
+   // Consumer: release the element returned by front()
+   void pop()
+   {
+      tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   }
+
+   // Producer: wait until the consumer released all published elements
+   void flush()
+   {
+      const std::size_t h = head.load(std::memory_order_relaxed);
+      int spins = 0;
+      while(tail.load(std::memory_order_acquire) != h) wait(spins);
+      cachedTail = h;
+   }
+
+private:
+   // Spin briefly, as the other side is usually only a few elements behind, then give up the core and finally
+   // sleep with a growing interval (up to 1 ms), so a side waiting for a slow or paced partner does not keep a core busy
+   static void wait(int& spins)
+   {
+      spins++;
+      if(spins <= 64) return;
+      if(spins <= 128)
+      {
+         std::this_thread::yield();
+         return;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(32 << std::min(spins - 129, 5)));
+   }
+
+   std::vector<T> buffer;
+   std::size_t mask = 0;
+
+   // Producer and consumer indices on separate cache lines, each side keeps a copy of the other index
+   alignas(64) std::atomic<std::size_t> head{0};
+   std::size_t cachedTail = 0;
+   alignas(64) std::atomic<std::size_t> tail{0};
+   std::size_t cachedHead = 0;
+};
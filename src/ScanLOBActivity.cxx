@@ -0,0 +1,356 @@
+#include "../../include/Enums.h"
+#include "../../include/Security.h"
+#include "../../include/TimeNS.h"
+#include "../../include/Windowing.h"
+
+#include "LOBParallelUnzipScope.h"
+
+#include <ROOT/TSeq.hxx>
+#include <ROOT/TThreadExecutor.hxx>
+#include <TFile.h>
+#include <TROOT.h>
+
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+
+// Scanner locating the most active periods of contracts, to choose the time windows of GenerateLiveLOBPlot.
+// The files are replayed in parallel, each in a single pass collecting the per second statistics of all its requested
+// contracts, after which every window of the requested length is scored and the top K non-overlapping windows are
+// returned. As a file has to be replayed in order, each file is scanned by one thread; with fewer files than threads
+// the spare threads decompress the input of the files being scanned, e.g.:
+//    auto bursts = ScanLOBActivity(rootPath, {{"20151112.root", "ESZ5"}, {"20151113.root", "ESZ5"}}, beginTime, endTime);
+//    GenerateLiveLOBPlot(rootPath, "burst.root", bursts[0].beginTime, bursts[0].endTime, title, snapshotSize, configs, bursts[0].verticalLines, false);
+
+// Parameters of the scan
+struct LOBScanOptions
+{
+   // Length of the returned windows
+   TimeNS windowLength = 10 * 60 * T_Second;
+   // Windows start on multiples of this step (whole seconds), use a multiple of the snapshot size of the plot
+   TimeNS step = T_Second;
+   // Number of windows to return
+   int topK = 10;
+   // Number of threads, 0 for all cores. At most one thread replays each file, the others only help decompressing
+   // its input, so a scan of fewer files than threads is limited by the replay speed of a single core.
+   unsigned int threads = 0;
+
+   // Weights of the rates in the score, each rate is relative to its average over the whole scan:
+   // book update messages, traded volume, level 1 cancelled volume and the mean spread
+   double messageWeight = 1;
+   double tradeWeight = 1;
+   double cancellationWeight = 1;
+   double spreadWeight = 0;
+};
+
+// Statistics of one second of a contract
+struct LOBSecondStats
+{
+   long messages = 0;
+   long trades = 0;
+   long tradeVolume = 0;
+   long cancellations = 0;
+   double spreadSum = 0;  // sum of the spread (ticks) after each message with both sides of the book present
+   long spreadSamples = 0;
+   int maxSpread = 0;
+};
+
+// A window found by the scanner, beginTime, endTime and verticalLines can be passed to GenerateLiveLOBPlot
+struct LOBBurst
+{
+   std::string contract;
+   TimeNS beginTime = 0;
+   TimeNS endTime = 0;
+   double score = 0;
+
+   long messages = 0;
+   long trades = 0;
+   long tradeVolume = 0;
+   long cancellations = 0;
+   double meanSpread = 0;
+   int maxSpread = 0;
+
+   // Start of the second with the most messages
+   TimeNS peakTime = 0;
+   std::vector<std::pair<TimeNS, std::string>> verticalLines;
+};
+
+// Replay the contracts of a single file in one pass, runs in a worker thread. Returns the seconds of each contract,
+// contracts which are not traded in the file are left out.
+std::map<std::string, std::vector<LOBSecondStats>> scanLOBFile(const std::string& filePath, const std::vector<std::string>& contracts, TimeNS beginTime, TimeNS endTime)
+{
+   std::map<std::string, std::vector<LOBSecondStats>> results;
+
+   TFile file(filePath.c_str());
+   if(file.IsZombie()) throw std::invalid_argument("Could not open " + filePath);
+
+   MetaData_t metaData;
+   ReadMetaData(file, metaData);
+
+   std::set<int> ids;
+   std::map<int, std::vector<LOBSecondStats>*> contractSeconds;
+   for(auto& contract : contracts)
+   {
+      const int contractID = MetaDataGetID(metaData, contract);
+      if(contractID == -1) continue;
+
+      auto& seconds = results[contract];
+      seconds.resize((endTime - beginTime) / T_Second + 1);
+      ids.insert(contractID);
+      contractSeconds[contractID] = &seconds;
+   }
+   if(ids.empty()) return results;
+
+   Windower<> windower;
+   windower.addTree(&file, "Messages");
+   windower.setIdFilter(ids);
+   windower.setDefaultStateInitializerAndUpdater(&metaData);
+
+   windower.setForEachRow([&](int id, TimeNS time, const MRow& row, const Security& security)
+   {
+      if (beginTime <= time && time <= endTime)
+      {
+         auto& second = (*contractSeconds.at(id))[(time - beginTime) / T_Second];
+
+         if(row.messageKind >= (char)MessageKind::BidNew
+            && row.messageKind <= (char)MessageKind::AskDelete)
+         {
+            second.messages++;
+
+            for(auto a : *security.getLastUpdateActions())
+            {
+               if(a.actionType == ActionType::DeleteAction && a.level == 1)
+               {
+                  second.cancellations += a.volume;
+               }
+            }
+
+            auto bidBook = security.getBook(BookSide::BidConsolidated);
+            auto askBook = security.getBook(BookSide::AskConsolidated);
+            if(bidBook->size() >= 1 && askBook->size() >= 1)
+            {
+               const int spread = askBook->at(0).price - bidBook->at(0).price;
+               second.spreadSum += spread;
+               second.spreadSamples++;
+               second.maxSpread = std::max(second.maxSpread, spread);
+            }
+         }
+         else if (row.messageKind == static_cast<char>(MessageKind::Trade)
+            && row.quoteCondition == static_cast<char>(QuoteCondition::Trade))
+         {
+            second.trades++;
+            second.tradeVolume += row.quantity;
+         }
+      }
+   });
+
+   windower.run();
+
+   return results;
+}
+
+// Main function of the scanner
+// Parameters:
+//    rootPath: the path to the input ROOT files
+//    inputs: the file names and contracts to scan, e.g. the fileName and contract of the LOBPlotConfigs
+//    beginTime, endTime: the period to scan, whole seconds
+//    options: parameters of the scan, as defined above
+// Returns the top K windows, highest score first. Overlapping windows are skipped, also between contracts.
+std::vector<LOBBurst> ScanLOBActivity(const std::string& rootPath,
+   const std::vector<std::pair<std::string, std::string>>& inputs,
+   const TimeNS beginTime, const TimeNS endTime,
+   const LOBScanOptions& options = LOBScanOptions())
+{
+   if(beginTime % T_Second != 0 || endTime % T_Second != 0 || options.step % T_Second != 0 || options.step <= 0)
+   {
+      throw std::invalid_argument("The scan period and step must be whole seconds");
+   }
+   if(options.windowLength % options.step != 0 || options.windowLength <= 0)
+   {
+      throw std::invalid_argument("The window length must be a multiple of the step");
+   }
+
+   // One task per file, with all of its contracts
+   std::map<std::string, std::vector<std::string>> fileContracts;
+   for(auto& input : inputs)
+   {
+      auto& contracts = fileContracts[input.first];
+      if(std::find(contracts.begin(), contracts.end(), input.second) == contracts.end())
+      {
+         contracts.push_back(input.second);
+      }
+   }
+   std::vector<std::pair<std::string, std::vector<std::string>>> tasks(fileContracts.begin(), fileContracts.end());
+
+   ROOT::EnableThreadSafety();
+   ROOT::TThreadExecutor executor(options.threads);
+
+   // With fewer files than threads the idle threads of the pool decompress the input in parallel
+   std::unique_ptr<LOBParallelUnzipScope> parallelUnzip;
+   if(tasks.size() < executor.GetPoolSize())
+   {
+      parallelUnzip = std::make_unique<LOBParallelUnzipScope>(executor.GetPoolSize());
+   }
+
+   std::cout << "Scanning " << tasks.size() << " files on " << std::min<std::size_t>(tasks.size(), executor.GetPoolSize()) << " threads"
+      << (parallelUnzip ? " with parallel decompression" : "") << "\n";
+
+   auto results = executor.Map([&](unsigned int i)
+   {
+      return scanLOBFile(rootPath + "/" + tasks[i].first, tasks[i].second, beginTime, endTime);
+   }, ROOT::TSeqU(tasks.size()));
+
+   // Merge the files of each contract, contracts which are not traded in any file are scanned as empty
+   std::map<std::string, std::vector<LOBSecondStats>> contracts;
+   for(auto& input : inputs)
+   {
+      contracts[input.second].resize((endTime - beginTime) / T_Second + 1);
+   }
+   for(auto& result : results)
+   {
+      for(auto& contract : result)
+      {
+         auto& seconds = contracts[contract.first];
+         for(int s = 0; s < seconds.size(); s++)
+         {
+            seconds[s].messages += contract.second[s].messages;
+            seconds[s].trades += contract.second[s].trades;
+            seconds[s].tradeVolume += contract.second[s].tradeVolume;
+            seconds[s].cancellations += contract.second[s].cancellations;
+            seconds[s].spreadSum += contract.second[s].spreadSum;
+            seconds[s].spreadSamples += contract.second[s].spreadSamples;
+            seconds[s].maxSpread = std::max(seconds[s].maxSpread, contract.second[s].maxSpread);
+         }
+      }
+   }
+
+   // Score every window of every contract
+   struct Candidate
+   {
+      const std::string* contract;
+      long first;  // first second of the window
+      double score;
+   };
+   std::vector<Candidate> candidates;
+
+   const long windowSeconds = options.windowLength / T_Second;
+   const long stepSeconds = options.step / T_Second;
+   const long firstStart = ((beginTime + options.step - 1) / options.step * options.step - beginTime) / T_Second;
+
+   for(auto& contract : contracts)
+   {
+      const auto& seconds = contract.second;
+
+      // Running sums of the rates, the windows are scored from differences
+      std::vector<double> messages(1, 0), tradeVolume(1, 0), cancellations(1, 0), spreadSum(1, 0), spreadSamples(1, 0);
+      for(auto& second : seconds)
+      {
+         messages.push_back(messages.back() + second.messages);
+         tradeVolume.push_back(tradeVolume.back() + second.tradeVolume);
+         cancellations.push_back(cancellations.back() + second.cancellations);
+         spreadSum.push_back(spreadSum.back() + second.spreadSum);
+         spreadSamples.push_back(spreadSamples.back() + second.spreadSamples);
+      }
+
+      const double meanMessages = messages.back() / seconds.size();
+      const double meanTradeVolume = tradeVolume.back() / seconds.size();
+      const double meanCancellations = cancellations.back() / seconds.size();
+      const double meanSpread = spreadSamples.back() > 0 ? spreadSum.back() / spreadSamples.back() : 0;
+
+      // Windows end before the last second, which only contains endTime itself
+      for(long first = firstStart; first + windowSeconds < seconds.size(); first += stepSeconds)
+      {
+         const long last = first + windowSeconds;
+
+         double score = 0;
+         if(meanMessages > 0) score += options.messageWeight * (messages[last] - messages[first]) / windowSeconds / meanMessages;
+         if(meanTradeVolume > 0) score += options.tradeWeight * (tradeVolume[last] - tradeVolume[first]) / windowSeconds / meanTradeVolume;
+         if(meanCancellations > 0) score += options.cancellationWeight * (cancellations[last] - cancellations[first]) / windowSeconds / meanCancellations;
+         if(meanSpread > 0 && spreadSamples[last] > spreadSamples[first])
+         {
+            score += options.spreadWeight * (spreadSum[last] - spreadSum[first]) / (spreadSamples[last] - spreadSamples[first]) / meanSpread;
+         }
+
+         candidates.push_back({&contract.first, first, score});
+      }
+   }
+
+   std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b)
+   {
+      return a.score > b.score || (a.score == b.score && a.first < b.first);
+   });
+
+   // Take the best windows which do not overlap with a better one
+   std::vector<LOBBurst> bursts;
+   for(auto& candidate : candidates)
+   {
+      if(bursts.size() >= options.topK) break;
+
+      const TimeNS windowBegin = beginTime + candidate.first * T_Second;
+      const TimeNS windowEnd = windowBegin + options.windowLength;
+
+      bool overlaps = false;
+      for(auto& burst : bursts)
+      {
+         overlaps = overlaps || (windowBegin < burst.endTime && burst.beginTime < windowEnd);
+      }
+      if(overlaps) continue;
+
+      bursts.emplace_back();
+      auto& burst = bursts.back();
+      burst.contract = *candidate.contract;
+      burst.beginTime = windowBegin;
+      burst.endTime = windowEnd;
+      burst.score = candidate.score;
+
+      const auto& seconds = contracts.at(burst.contract);
+      long peakMessages = -1;
+      long spreadSamples = 0;
+      double spreadSum = 0;
+      for(long s = candidate.first; s < candidate.first + windowSeconds; s++)
+      {
+         burst.messages += seconds[s].messages;
+         burst.trades += seconds[s].trades;
+         burst.tradeVolume += seconds[s].tradeVolume;
+         burst.cancellations += seconds[s].cancellations;
+         burst.maxSpread = std::max(burst.maxSpread, seconds[s].maxSpread);
+         spreadSum += seconds[s].spreadSum;
+         spreadSamples += seconds[s].spreadSamples;
+
+         if(seconds[s].messages > peakMessages)
+         {
+            peakMessages = seconds[s].messages;
+            burst.peakTime = beginTime + s * T_Second;
+         }
+      }
+      burst.meanSpread = spreadSamples > 0 ? spreadSum / spreadSamples : 0;
+
+      burst.verticalLines.emplace_back(burst.peakTime, "Peak activity " + burst.contract);
+   }
+
+   for(int i = 0; i < bursts.size(); i++)
+   {
+      const auto& burst = bursts[i];
+      std::cout << i + 1 << ": " << burst.contract
+         << ", begin: " << burst.beginTime
+         << ", end: " << burst.endTime
+         << std::setprecision(5)
+         << ", score: " << burst.score
+         << ", messages: " << burst.messages
+         << ", trades: " << burst.trades
+         << ", trade volume: " << burst.tradeVolume
+         << ", cancellations: " << burst.cancellations
+         << ", mean spread (ticks): " << burst.meanSpread
+         << ", max spread (ticks): " << burst.maxSpread
+         << "\n";
+   }
+
+   return bursts;
+}
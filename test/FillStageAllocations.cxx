@@ -0,0 +1,385 @@
+// Checks that the replay does not allocate: a synthetic replay cache of two contracts is written, then replayed
+// through the book stage (LOBBookStage::replay, emitting Window, Message and Trade events with views of the cached
+// books) into the fill stage, serially and pipelined, while counting the calls of operator new/delete. The filled
+// counts are compared with the ones expected from the synthetic messages, and both modes have to fill the same plots.
+//
+// Built by CMake (target FillStageAllocations) and run by ctest.
+
+#include "../src/GenerateLiveLOBPlot.cxx"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+   // Also counted in the fill thread in pipelined mode
+   std::atomic<bool> counting(false);
+   std::atomic<long> allocations(0);
+   std::atomic<long> deallocations(0);
+
+   void* allocate(std::size_t size)
+   {
+      if(counting) allocations++;
+      if(void* p = std::malloc(size ? size : 1)) return p;
+      throw std::bad_alloc();
+   }
+
+   void deallocate(void* p)
+   {
+      if(counting && p) deallocations++;
+      std::free(p);
+   }
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, std::size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, std::size_t) noexcept { deallocate(p); }
+
+constexpr int NUMBEROFCONTRACTS = 2;
+constexpr int SECONDS = 60;        // length of the plotted period
+constexpr int MARGINSECONDS = 5;   // the cache also holds messages before and after the plotted period
+constexpr int MESSAGESPERSECOND = 50;
+constexpr int TRADEINTERVAL = 6;   // one trade every TRADEINTERVAL messages
+constexpr int DEPTH = 10;          // levels of each side
+constexpr int FIRSTID = 101;
+
+const TimeNS beginTime = MARGINSECONDS * T_Second;
+const TimeNS endTime = beginTime + SECONDS * T_Second;
+const TimeNS verticalLineTime = beginTime + 10 * T_Second + T_Second / 3;
+
+// Per contract counts of the synthetic replay within the plotted period
+struct ExpectedCounts
+{
+   std::vector<long> messages = std::vector<long>(NUMBEROFCONTRACTS, 0);
+   std::vector<long> trades = std::vector<long>(NUMBEROFCONTRACTS, 0);
+   std::vector<long> tradeVolume = std::vector<long>(NUMBEROFCONTRACTS, 0);
+   std::vector<long> bidTradeVolume = std::vector<long>(NUMBEROFCONTRACTS, 0);
+   std::vector<long> askTradeVolume = std::vector<long>(NUMBEROFCONTRACTS, 0);
+   long long verticalLineMessage = 0; // messages before the vertical line
+};
+
+// A book around a mid point moving with the message number, different for each contract
+void fillSample(LOBBookSample& sample, long long messageNumber, int contract)
+{
+   const int mid = 1010 + static_cast<int>((messageNumber / 100 + contract) % 5);
+
+   sample.bidLevels = DEPTH;
+   sample.askLevels = DEPTH;
+   for(int i = 0; i < DEPTH; i++)
+   {
+      sample.bid()[i] = LOBLevel{mid - 1 - i, 10 + i + static_cast<int>(messageNumber % 7)};
+      sample.ask()[i] = LOBLevel{mid + 1 + i, 20 + i};
+   }
+
+   sample.price = mid * 0.25;
+   sample.bidVolume = 60;
+   sample.askVolume = 110;
+   sample.apmBid = mid - 0.5;
+   sample.apmAsk = mid + 0.5;
+   sample.midPoint = (mid + 0.5) * 0.25;
+}
+
+// Write the messages and trades of the contracts, from 0 to MARGINSECONDS after endTime, into a replay cache
+ExpectedCounts writeSyntheticCache(const std::string& path, const std::string& key)
+{
+   std::vector<LOBCacheSlot> slots(NUMBEROFCONTRACTS);
+   for(int c = 0; c < NUMBEROFCONTRACTS; c++)
+   {
+      slots[c].id = FIRSTID + c;
+      slots[c].priceIncrease = 0.25;
+   }
+
+   LOBCache::Writer writer(path, key, slots);
+   ExpectedCounts expected;
+
+   // The current book of each contract and its record, as in buildReplayCache
+   std::vector<LOBBookSample> samples(NUMBEROFCONTRACTS);
+   std::vector<LOBCacheBook> books(NUMBEROFCONTRACTS);
+   LOBBookSample sample;
+   sample.reserve(DEPTH);
+   for(auto& contractSample : samples)
+   {
+      contractSample.reserve(DEPTH);
+   }
+
+   long long messageNumber = 0;
+   for(int second = 0; second < SECONDS + 2 * MARGINSECONDS; second++)
+   {
+      for(int m = 0; m < MESSAGESPERSECOND; m++, messageNumber++)
+      {
+         const TimeNS time = second * T_Second + m * (T_Second / MESSAGESPERSECOND);
+         const bool plotted = beginTime <= time && time <= endTime;
+
+         // A book update of one contract, deleting volume at the best levels every few messages
+         const int slot = messageNumber % NUMBEROFCONTRACTS;
+         fillSample(sample, messageNumber, slot);
+
+         LOBCacheRecord record;
+         record.time = time;
+         record.id = FIRSTID + slot;
+         record.slot = slot;
+         record.kind = LOBCacheRecordKind::Message;
+
+         std::vector<LOBLevel> deletes;
+         if(messageNumber % 3 == 0) deletes.push_back(LOBLevel{sample.bid()[0].price, 1});
+         record.message.bidDeletes = deletes.size();
+         if(messageNumber % 5 == 0) deletes.push_back(LOBLevel{sample.ask()[0].price, 2});
+         record.message.askDeletes = deletes.size() - record.message.bidDeletes;
+         record.message.deletes = writer.addEntries(deletes.data(), deletes.size());
+
+         record.message.lowestBid = sample.bid()[DEPTH - 1].price;
+         record.message.highestAsk = sample.ask()[DEPTH - 1].price;
+         record.message.maxLevelVolume = 0;
+         for(int i = 0; i < DEPTH; i++)
+         {
+            record.message.maxLevelVolume = std::max({record.message.maxLevelVolume, sample.bid()[i].volume, sample.ask()[i].volume});
+         }
+
+         storeCacheBook(writer, sample, samples[slot], books[slot], record.book);
+         writer.add(record);
+         std::swap(samples[slot], sample);
+         books[slot] = record.book;
+
+         if(plotted)
+         {
+            expected.messages[slot]++;
+            if(time < verticalLineTime) expected.verticalLineMessage++;
+         }
+
+         // A trade after the message, at the best bid, at the best ask or in between
+         if(messageNumber % TRADEINTERVAL == 0)
+         {
+            const long long tradeNumber = messageNumber / TRADEINTERVAL;
+            const int tradeSlot = tradeNumber % NUMBEROFCONTRACTS;
+            const auto& book = samples[tradeSlot];
+
+            LOBCacheRecord trade;
+            trade.time = time;
+            trade.id = FIRSTID + tradeSlot;
+            trade.slot = tradeSlot;
+            trade.kind = LOBCacheRecordKind::Trade;
+            trade.book = books[tradeSlot];
+            trade.trade.quantity = 5 + tradeNumber % 4;
+            trade.trade.hasBestBid = book.bidLevels > 0;
+            trade.trade.hasBestAsk = book.askLevels > 0;
+            trade.trade.bestBid = book.bid()[0].price;
+            trade.trade.bestAsk = book.ask()[0].price;
+            trade.trade.price = tradeNumber % 3 == 0 ? trade.trade.bestBid : tradeNumber % 3 == 1 ? trade.trade.bestAsk : trade.trade.bestBid + 1;
+            writer.add(trade);
+
+            if(plotted)
+            {
+               expected.trades[tradeSlot]++;
+               expected.tradeVolume[tradeSlot] += trade.trade.quantity;
+               if(tradeNumber % 3 == 0) expected.bidTradeVolume[tradeSlot] += trade.trade.quantity;
+               if(tradeNumber % 3 == 1) expected.askTradeVolume[tradeSlot] += trade.trade.quantity;
+            }
+         }
+      }
+   }
+
+   writer.finish();
+   return expected;
+}
+
+// What a replay filled, to compare the serial and the pipelined replay
+struct ReplayResult
+{
+   long allocations = 0;
+   long deallocations = 0;
+   long long messages = 0;
+   std::vector<std::vector<double>> snapshotPoints;
+   std::vector<double> verticalLinesMessage;
+   std::vector<long> ownMessages;
+   std::vector<long> windows;
+   std::vector<std::vector<std::size_t>> trades; // per config: window trades, then message trades of every skip
+   std::vector<long> tradeVolume;
+   std::vector<long> bidTradeVolume;
+   std::vector<long> askTradeVolume;
+   std::vector<double> contents; // bin contents and spread markers of all configs
+};
+
+// Plot the synthetic period from the cache as GenerateLiveLOBPlot does, counting the allocations of the replay
+ReplayResult replay(const LOBCache& cache, bool pipelined)
+{
+   const std::vector<TimeNS> snapshotSizes = {T_Second, 10 * T_Second};
+   const std::vector<long long> snapshotRatios = {1, 10};
+   const std::vector<int> skips = {1, 10};
+   const int yBinMargin = 3;
+
+   // The configs list the contracts in the opposite order of the cache slots
+   std::vector<LOBPlotConfig> configs(NUMBEROFCONTRACTS);
+   std::vector<int> cacheSlots;
+   for(int i = 0; i < NUMBEROFCONTRACTS; i++)
+   {
+      cacheSlots.push_back(NUMBEROFCONTRACTS - 1 - i);
+      configs[i].contract = "TEST" + std::to_string(cacheSlots[i] + 1);
+      configs[i].yAxisTitle = "Price";
+      configs[i].contractID = cache.slot(cacheSlots[i]).id;
+      configs[i].priceIncrease = cache.slot(cacheSlots[i]).priceIncrease;
+   }
+
+   getPeriodStats(configs, beginTime, endTime, "", false, &cache);
+
+   long numberOfMessages = 0;
+   for(auto& config : configs)
+   {
+      numberOfMessages += config.messages;
+   }
+   for(int i = 0; i < NUMBEROFCONTRACTS; i++)
+   {
+      configs[i].setupSeries(skips, configs[i].contract, endTime - beginTime, numberOfMessages, snapshotSizes, i + 1, yBinMargin);
+   }
+
+   LOBFillStage fill;
+   fill.setup(configs, beginTime, endTime, snapshotSizes, snapshotRatios, skips, numberOfMessages, yBinMargin);
+
+   LOBBookStage bookStage;
+   bookStage.setup(configs, fill, snapshotRatios, skips, {verticalLineTime}, pipelined);
+
+   allocations = 0;
+   deallocations = 0;
+   counting = true;
+
+   bookStage.replay(cache, cacheSlots, beginTime, endTime, T_Second);
+   bookStage.finish();
+
+   counting = false;
+
+   ReplayResult result;
+   result.allocations = allocations;
+   result.deallocations = deallocations;
+   result.messages = fill.currentMessageNumber;
+   result.snapshotPoints = fill.messagePlotSnapshotPoints;
+   result.verticalLinesMessage = bookStage.verticalLinesMessage;
+   for(auto& config : configs)
+   {
+      result.ownMessages.push_back(config.numberOfMessagesSinceStart);
+      result.windows.push_back(config.windows[0].currentWindowNumber);
+
+      result.trades.emplace_back();
+      result.trades.back().push_back(config.windows[0].windowTrades.size());
+      for(auto& series : config.messageSeries)
+      {
+         result.trades.back().push_back(series.messageTrades.size());
+      }
+      result.tradeVolume.push_back(config.totalTradeVolume);
+      result.bidTradeVolume.push_back(config.bidTradeVolume);
+      result.askTradeVolume.push_back(config.askTradeVolume);
+
+      for(auto& series : config.windows)
+      {
+         for(int x = 1; x <= series.histWindowLob->GetNbinsX(); x++)
+         {
+            for(int y = 1; y <= series.histWindowLob->GetNbinsY(); y++)
+            {
+               result.contents.push_back(series.histWindowLob->GetBinContent(x, y));
+            }
+            result.contents.push_back(series.histWindowPrice->GetBinContent(x));
+            result.contents.push_back(series.histWindowCancellationsBid->GetBinContent(x));
+         }
+         result.contents.insert(result.contents.end(), series.spreadWindowMarker.x.begin(), series.spreadWindowMarker.x.end());
+         result.contents.insert(result.contents.end(), series.spreadWindowMarker.y.begin(), series.spreadWindowMarker.y.end());
+      }
+      for(auto& series : config.messageSeries)
+      {
+         for(int x = 1; x <= series.histMessageLob->GetNbinsX(); x++)
+         {
+            for(int y = 1; y <= series.histMessageLob->GetNbinsY(); y++)
+            {
+               result.contents.push_back(series.histMessageLob->GetBinContent(x, y));
+            }
+            result.contents.push_back(series.histMessagePrice->GetBinContent(x));
+            result.contents.push_back(series.histMessageCancellationsAsk->GetBinContent(x));
+         }
+         result.contents.insert(result.contents.end(), series.spreadMessageMarker.x.begin(), series.spreadMessageMarker.x.end());
+         result.contents.insert(result.contents.end(), series.spreadMessageMarker.y.begin(), series.spreadMessageMarker.y.end());
+      }
+   }
+
+   return result;
+}
+
+int main()
+{
+   int failures = 0;
+   auto check = [&](bool condition, const std::string& what)
+   {
+      if(!condition)
+      {
+         std::cout << "FAILED: " << what << std::endl;
+         failures++;
+      }
+   };
+
+   char directoryPattern[] = "/tmp/lobreplaytestXXXXXX";
+   if(!mkdtemp(directoryPattern))
+   {
+      std::cout << "Could not create a temporary directory" << std::endl;
+      return 1;
+   }
+   const std::string directory = directoryPattern;
+   const std::string key = "synthetic replay\n";
+   const std::string path = LOBCache::path(directory, key);
+
+   const ExpectedCounts expected = writeSyntheticCache(path, key);
+
+   LOBCache cache;
+   if(!cache.open(path, key))
+   {
+      std::cout << "Could not open the synthetic replay cache " << path << std::endl;
+      return 1;
+   }
+
+   long long expectedMessages = 0;
+   for(auto messages : expected.messages)
+   {
+      expectedMessages += messages;
+   }
+
+   std::vector<ReplayResult> results;
+   for(bool pipelined : {false, true})
+   {
+      const std::string mode = pipelined ? "pipelined: " : "serial: ";
+      results.push_back(replay(cache, pipelined));
+      const auto& result = results.back();
+
+      check(result.allocations == 0, mode + std::to_string(result.allocations) + " allocations while replaying");
+      check(result.deallocations == 0, mode + std::to_string(result.deallocations) + " deallocations while replaying");
+      check(result.messages == expectedMessages, mode + "all messages filled");
+      check(result.snapshotPoints[0].size() == SECONDS + 1, mode + "one snapshot point per second");
+      check(result.snapshotPoints[1].size() == SECONDS / 10 + 1, mode + "one snapshot point per 10 seconds");
+      check(result.verticalLinesMessage.size() == 1 && result.verticalLinesMessage[0] == expected.verticalLineMessage, mode + "message number at the vertical line");
+
+      for(int i = 0; i < NUMBEROFCONTRACTS; i++)
+      {
+         // Config i plots the contract of slot NUMBEROFCONTRACTS - 1 - i
+         const int slot = NUMBEROFCONTRACTS - 1 - i;
+         const std::string contract = mode + "config " + std::to_string(i + 1) + " ";
+
+         check(result.ownMessages[i] == expected.messages[slot], contract + "own messages counted");
+         check(result.windows[i] == SECONDS + 1, contract + "all snapshots filled");
+         for(auto trades : result.trades[i])
+         {
+            check(static_cast<long>(trades) == expected.trades[slot], contract + std::to_string(trades) + " trades instead of " + std::to_string(expected.trades[slot]));
+         }
+         check(result.tradeVolume[i] == expected.tradeVolume[slot], contract + "trade volume");
+         check(result.bidTradeVolume[i] == expected.bidTradeVolume[slot], contract + "trade volume at the best bid");
+         check(result.askTradeVolume[i] == expected.askTradeVolume[slot], contract + "trade volume at the best ask");
+      }
+
+      std::cout << mode << result.messages << " messages, " << result.allocations << " allocations, " << result.deallocations << " deallocations" << std::endl;
+   }
+
+   check(results[0].contents == results[1].contents, "the serial and the pipelined replay fill the same plots");
+
+   cache.close();
+   std::remove(path.c_str());
+   rmdir(directory.c_str());
+
+   return failures == 0 ? 0 : 1;
+}
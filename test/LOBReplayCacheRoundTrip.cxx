@@ -0,0 +1,195 @@
+// Round trip of the replay cache: records, entries and slots written by LOBReplayCache::Writer are read back
+// after open(), and seek() is compared with a linear search for times before, inside and after the records.
+// Also checks that unfinished and concurrent writers leave no temporary files or mixed up caches behind.
+//
+// Built by CMake (target LOBReplayCacheRoundTrip) and run by ctest.
+
+#include "../src/LOBReplayCache.cxx"
+
+#include <dirent.h>
+
+#include <iostream>
+
+struct TestRecord
+{
+   TimeNS time;
+   int slot;
+   int value;
+   long long entries; // position of `value` entries
+};
+
+struct TestEntry
+{
+   int a;
+   int b;
+};
+
+struct TestSlot
+{
+   int id;
+   double priceIncrease;
+};
+
+using TestCache = LOBReplayCache<TestRecord, TestEntry, TestSlot>;
+
+// The names of the files in a directory
+std::vector<std::string> listDirectory(const std::string& directory)
+{
+   std::vector<std::string> names;
+   if(DIR* dir = opendir(directory.c_str()))
+   {
+      while(dirent* entry = readdir(dir))
+      {
+         const std::string name = entry->d_name;
+         if(name != "." && name != "..") names.push_back(name);
+      }
+      closedir(dir);
+   }
+   std::sort(names.begin(), names.end());
+   return names;
+}
+
+// Records of two slots, with a gap of several seconds and several records in the same second
+std::vector<TestRecord> makeRecords()
+{
+   const std::vector<TimeNS> times = {
+      T_Second / 2, T_Second + 200 * T_Milis, T_Second + 700 * T_Milis, T_Second + 700 * T_Milis,
+      3 * T_Second + 100 * T_Milis, 7 * T_Second, 7 * T_Second + 1, 8 * T_Second + 999 * T_Milis};
+
+   std::vector<TestRecord> records;
+   for(std::size_t i = 0; i < times.size(); i++)
+   {
+      // Slot 1 only starts with the third record
+      records.push_back(TestRecord{times[i], i < 2 ? 0 : static_cast<int>(i % 2), static_cast<int>(i), 0});
+   }
+   return records;
+}
+
+void writeCache(TestCache::Writer& writer, std::vector<TestRecord>& records)
+{
+   for(auto& record : records)
+   {
+      std::vector<TestEntry> entries;
+      for(int e = 0; e < record.value; e++)
+      {
+         entries.push_back(TestEntry{record.value, e});
+      }
+      record.entries = writer.addEntries(entries.data(), entries.size());
+      writer.add(record);
+   }
+}
+
+int main()
+{
+   int failures = 0;
+   auto check = [&](bool condition, const std::string& what)
+   {
+      if(!condition)
+      {
+         std::cout << "FAILED: " << what << std::endl;
+         failures++;
+      }
+   };
+
+   char directoryPattern[] = "/tmp/lobcachetestXXXXXX";
+   if(!mkdtemp(directoryPattern))
+   {
+      std::cout << "Could not create a temporary directory" << std::endl;
+      return 1;
+   }
+   const std::string directory = directoryPattern;
+
+   const std::string key = "file input.root 1234 1700000000\ncontract A 10000\n";
+   const std::string path = TestCache::path(directory, key);
+   const std::vector<TestSlot> slots = {{7, 0.25}, {9, 0.5}};
+
+   auto records = makeRecords();
+
+   // An unfinished writer leaves nothing behind
+   {
+      TestCache::Writer writer(path, key, slots);
+      writeCache(writer, records);
+   }
+   check(listDirectory(directory).empty(), "no files after an unfinished writer");
+
+   // Records have to be added in time order
+   {
+      TestCache::Writer writer(path, key, slots);
+      writer.add(records[1]);
+      bool thrown = false;
+      try
+      {
+         writer.add(records[0]);
+      }
+      catch(const std::runtime_error&)
+      {
+         thrown = true;
+      }
+      check(thrown, "records out of time order are rejected");
+   }
+
+   // Two writers of the same cache at the same time, e.g. two jobs on the same input, write separate files
+   {
+      TestCache::Writer first(path, key, slots);
+      TestCache::Writer second(path, key, slots);
+      auto secondRecords = records;
+      writeCache(first, records);
+      writeCache(second, secondRecords);
+      first.finish();
+      check(listDirectory(directory).size() == 3, "the first finished cache next to the temporary files of the second");
+      second.finish();
+   }
+   check(listDirectory(directory).size() == 1, "only the cache file after both writers finished");
+
+   TestCache cache;
+   check(!cache.open(path, "another key"), "a cache of another key is not opened");
+   check(!cache.open(directory + "/missing.bin", key), "a missing cache is not opened");
+   check(cache.open(path, key), "the cache is opened");
+
+   check(cache.size() == records.size(), "number of records");
+   check(cache.numberOfSlots() == 2, "number of slots");
+   for(int s = 0; s < cache.numberOfSlots() && s < 2; s++)
+   {
+      check(cache.slot(s).id == slots[s].id && cache.slot(s).priceIncrease == slots[s].priceIncrease, "slot " + std::to_string(s));
+   }
+
+   for(std::size_t i = 0; i < cache.size() && i < records.size(); i++)
+   {
+      const auto& record = cache.at(i);
+      check(record.time == records[i].time && record.slot == records[i].slot && record.value == records[i].value, "record " + std::to_string(i));
+
+      const TestEntry* entries = cache.entries(record.entries);
+      for(int e = 0; e < record.value; e++)
+      {
+         check(entries[e].a == record.value && entries[e].b == e, "entry " + std::to_string(e) + " of record " + std::to_string(i));
+      }
+   }
+
+   // seek() against a linear search, from before the first record to after the last one
+   for(TimeNS time = -T_Second; time <= 10 * T_Second; time += 50 * T_Milis)
+   {
+      std::size_t expected = 0;
+      std::vector<long long> expectedLast(slots.size(), -1);
+      while(expected < records.size() && records[expected].time < time)
+      {
+         expectedLast[records[expected].slot] = expected;
+         expected++;
+      }
+
+      std::vector<long long> lastOfSlot;
+      const std::size_t position = cache.seek(time, lastOfSlot);
+      check(position == expected && lastOfSlot == expectedLast, "seek to " + std::to_string(time) + " ns");
+   }
+
+   // Records at the same time as the seek time are included
+   std::vector<long long> lastOfSlot;
+   check(cache.seek(records[2].time, lastOfSlot) == 2, "seek to the time of a record");
+   check(cache.seek(records[6].time, lastOfSlot) == 6 && lastOfSlot[0] == 4 && lastOfSlot[1] == 5, "seek into a second with several records");
+
+   cache.close();
+   std::remove(path.c_str());
+   rmdir(directory.c_str());
+
+   std::cout << (failures == 0 ? "Replay cache round trip passed" : std::to_string(failures) + " failures") << std::endl;
+   return failures == 0 ? 0 : 1;
+}
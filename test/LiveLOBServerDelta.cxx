@@ -0,0 +1,176 @@
+// Checks the live view on localhost: a LiveLOBServer publishes a few columns of a histogram, a client thread polls
+// lobdelta.json over HTTP while the main thread answers the requests through pace(), then finish() serves the last
+// columns until the client has fetched them.
+//
+// Built by CMake (target LiveLOBServerDelta) and run by ctest. Usage: LiveLOBServerDelta [port], default 18080.
+
+#include "../src/LiveLOBServer.cxx"
+
+#include <TH2F.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+
+// GET a path from the server on localhost, returns the body or an empty string if the server does not answer
+std::string httpGet(int port, const std::string& path)
+{
+   const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+   while(std::chrono::steady_clock::now() < deadline)
+   {
+      const int fd = socket(AF_INET, SOCK_STREAM, 0);
+      if(fd < 0) return "";
+
+      sockaddr_in address = {};
+      address.sin_family = AF_INET;
+      address.sin_port = htons(port);
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+      {
+         // The server may not be listening yet
+         close(fd);
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+         continue;
+      }
+
+      const std::string request = "GET " + path + " HTTP/1.0\r\nHost: localhost\r\n\r\n";
+      if(send(fd, request.data(), request.size(), 0) != static_cast<ssize_t>(request.size()))
+      {
+         close(fd);
+         return "";
+      }
+
+      std::string response;
+      char buffer[4096];
+      ssize_t received;
+      while((received = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+      {
+         response.append(buffer, received);
+      }
+      close(fd);
+
+      const auto body = response.find("\r\n\r\n");
+      return body == std::string::npos ? "" : response.substr(body + 4);
+   }
+   return "";
+}
+
+int main(int argc, char** argv)
+{
+   const int port = argc > 1 ? std::stoi(argv[1]) : 18080;
+
+   int failures = 0;
+   auto check = [&](bool condition, const std::string& what, const std::string& response)
+   {
+      if(!condition)
+      {
+         std::cout << "FAILED: " << what << "\n   response: " << response << std::endl;
+         failures++;
+      }
+   };
+   auto contains = [](const std::string& text, const std::string& part)
+   {
+      return text.find(part) != std::string::npos;
+   };
+
+   TH2F lob("histWindowLobTest", "", 10, 0, 10, 20, 0, 20);
+   std::vector<double> spreadX;
+   std::vector<double> spreadY;
+   std::vector<double> trades;
+   spreadX.reserve(11);
+   spreadY.reserve(11);
+   trades.reserve(10);
+
+   // One column per sequence number, with a bid and an ask level, and a trade in every other column
+   auto fillColumn = [&](int column)
+   {
+      lob.SetBinContent(column, 5, 10 + column);
+      lob.SetBinContent(column, 8, 20 + column);
+      spreadX.push_back(column - 1);
+      spreadY.push_back(6.5 + column % 2);
+      if(column % 2 == 0) trades.push_back(column - 1);
+   };
+
+   LiveLOBServer server("http:" + std::to_string(port), 0);
+   const int handle = server.addSeries(1, "window", &lob, &spreadX, &spreadY, &trades, 0, 100);
+
+   for(int column = 1; column <= 3; column++)
+   {
+      fillColumn(column);
+   }
+   server.publish(handle, 3);
+
+   // While filling: the requests are only answered from pace()
+   std::atomic<bool> done(false);
+   std::string first;
+   std::thread client([&]()
+   {
+      first = httpGet(port, "/lobdelta.json?config=1&axis=window&since=0");
+      done = true;
+   });
+   while(!done)
+   {
+      server.pace(0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   client.join();
+
+   check(contains(first, "\"sequence\":3"), "first delta up to column 3", first);
+   check(contains(first, "\"published\":3"), "first delta published 3", first);
+   check(contains(first, "\"finished\":false"), "first delta not finished", first);
+   check(contains(first, "{\"bin\":1,\"levels\":[[5,11],[8,21]]}"), "first column", first);
+   check(contains(first, "{\"bin\":3,\"levels\":[[5,13],[8,23]]}"), "third column", first);
+   check(contains(first, "\"trades\":[1]"), "trade of the second column", first);
+
+   // An unknown series is not found
+   std::string missing;
+   done = false;
+   client = std::thread([&]()
+   {
+      missing = httpGet(port, "/lobdelta.json?config=2&axis=window&since=0");
+      done = true;
+   });
+   while(!done)
+   {
+      server.pace(0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   client.join();
+   check(!contains(missing, "\"sequence\""), "no delta for an unknown config", missing);
+
+   for(int column = 4; column <= 5; column++)
+   {
+      fillColumn(column);
+   }
+   server.publish(handle, 5);
+
+   // After the replay: the client polls until the server reports the last column as finished, finish() returns
+   // as soon as it was delivered
+   std::string last;
+   client = std::thread([&]()
+   {
+      long since = 3;
+      for(int poll = 0; poll < 100; poll++)
+      {
+         last = httpGet(port, "/lobdelta.json?config=1&axis=window&since=" + std::to_string(since));
+         if(contains(last, "\"finished\":true") && contains(last, "\"sequence\":5")) break;
+         std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+   });
+
+   const auto start = std::chrono::steady_clock::now();
+   server.finish(20);
+   const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   client.join();
+
+   check(contains(last, "\"sequence\":5") && contains(last, "\"finished\":true"), "last delta up to column 5 and finished", last);
+   check(contains(last, "{\"bin\":4,\"levels\":[[5,14],[8,24]]}"), "fourth column", last);
+   check(contains(last, "\"trades\":[3]"), "trade of the fourth column", last);
+   check(seconds < 10, "finish() returned after the last column was delivered, not at the deadline (" + std::to_string(seconds) + " s)", "");
+
+   std::cout << (failures == 0 ? "Live view deltas served on port " + std::to_string(port) : std::to_string(failures) + " failures") << std::endl;
+   return failures == 0 ? 0 : 1;
+}